@@ -47,6 +47,7 @@ BCFOrderedReader::BCFOrderedReader(std::string vcf_file, std::vector<GenomeInter
     idx = NULL;
     tbx = NULL;
     itr = NULL;
+    index_loaded = false;
 
     s = {0, 0, 0};
     vcf = bcf_open(vcf_file.c_str(), "r");
@@ -23,7 +23,7 @@
 
 #include "bcf_ordered_writer.h"
 
-BCFOrderedWriter::BCFOrderedWriter(std::string input_vcf_file, int32_t window)
+BCFOrderedWriter::BCFOrderedWriter(std::string input_vcf_file, int32_t window, int64_t resume_offset)
 {
     this->vcf_file = input_vcf_file;
     this->window = window;
@@ -49,7 +49,27 @@ BCFOrderedWriter::BCFOrderedWriter(std::string input_vcf_file, int32_t window)
     }
     if (ftype & FT_BCF) kputc('b', mode);
     if (ftype & FT_GZ) kputc('z', mode);
-    vcf = bcf_open(vcf_file.c_str(), mode->s);
+
+    if (resume_offset>=0)
+    {
+        if (vcf_file=="-")
+        {
+            fprintf(stderr, "[%s:%d %s] cannot resume writing to STDOUT\n", __FILE__,__LINE__,__FUNCTION__);
+            exit(1);
+        }
+
+        vcf = hts_open_truncated(vcf_file.c_str(), mode->s, resume_offset);
+    }
+    else
+    {
+        vcf = bcf_open(vcf_file.c_str(), mode->s);
+    }
+
+    if (!vcf)
+    {
+        fprintf(stderr, "[%s:%d %s] Cannot open %s\n", __FILE__,__LINE__,__FUNCTION__, vcf_file.c_str());
+        exit(1);
+    }
 
     hdr = bcf_hdr_init("w");
     bcf_hdr_append(hdr, "##fileformat=VCFv4.1");
@@ -151,6 +171,17 @@ void BCFOrderedWriter::flush()
     flush(true);
 }
 
+/**
+ * Writes out all buffered records and flushes the file.
+ * Returns the offset of the end of the output which may be
+ * used to resume writing to this file, -1 if unsuccessful.
+ */
+int64_t BCFOrderedWriter::checkpoint()
+{
+    flush(true);
+    return hts_flush_and_tell(vcf);
+}
+
 /**
  * Returns record to pool
  */
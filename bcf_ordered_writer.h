@@ -71,9 +71,11 @@ class BCFOrderedWriter
 
     /**
      * Initialize output file.
-     * @window - the window to keep variants in buffer to check for local disorder, 0 for no buffering
+     * @window        - the window to keep variants in buffer to check for local disorder, 0 for no buffering
+     * @resume_offset - offset returned by checkpoint(), an existing output file is truncated
+     *                  to this offset and written to from there, -1 to create a new file
      */
-    BCFOrderedWriter(std::string input_vcf_file, int32_t window=0);
+    BCFOrderedWriter(std::string input_vcf_file, int32_t window=0, int64_t resume_offset=-1);
 
     /**
      * Duplicates a hdr and sets it.
@@ -118,6 +120,13 @@ class BCFOrderedWriter
      */
     void flush();
 
+    /**
+     * Writes out all buffered records and flushes the file.
+     * Returns the offset of the end of the output which may be
+     * used to resume writing to this file, -1 if unsuccessful.
+     */
+    int64_t checkpoint();
+
     /**
      * Closes the file.
      */
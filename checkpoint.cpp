@@ -0,0 +1,190 @@
+/* The MIT License
+
+   Copyright (c) 2014 Adrian Tan <atks@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "checkpoint.h"
+
+/**
+ * Constructor.
+ *
+ * @output_file - the output file being checkpointed
+ */
+Checkpoint::Checkpoint(std::string output_file)
+{
+    checkpoint_file = output_file + ".ckpt";
+    chrom = "";
+    flushed_pos1 = 0;
+    next_pos1 = 0;
+    offset = -1;
+};
+
+/**
+ * Reads the checkpoint file, returns false if it does not exist or is invalid.
+ */
+bool Checkpoint::read()
+{
+    FILE *file = fopen(checkpoint_file.c_str(), "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    counters.clear();
+    offset = -1;
+    char key[1024];
+    char value[1024];
+    while (fscanf(file, "%1023s %1023s", key, value)==2)
+    {
+        if (!strcmp(key, "chrom"))
+        {
+            chrom = value;
+        }
+        else if (!strcmp(key, "flushed_pos1"))
+        {
+            flushed_pos1 = atoi(value);
+        }
+        else if (!strcmp(key, "next_pos1"))
+        {
+            next_pos1 = atoi(value);
+        }
+        else if (!strcmp(key, "offset"))
+        {
+            offset = strtoll(value, NULL, 10);
+        }
+        else
+        {
+            counters[key] = strtoul(value, NULL, 10);
+        }
+    }
+    fclose(file);
+
+    return chrom!="" && offset>=0;
+};
+
+/**
+ * Writes the checkpoint file, the previous checkpoint is replaced atomically.
+ */
+void Checkpoint::write()
+{
+    std::string temp_file = checkpoint_file + ".tmp";
+    FILE *file = fopen(temp_file.c_str(), "w");
+    if (!file)
+    {
+        fprintf(stderr, "[%s:%d %s] Cannot write checkpoint %s\n", __FILE__, __LINE__, __FUNCTION__, temp_file.c_str());
+        exit(1);
+    }
+
+    fprintf(file, "chrom\t%s\n", chrom.c_str());
+    fprintf(file, "flushed_pos1\t%d\n", flushed_pos1);
+    fprintf(file, "next_pos1\t%d\n", next_pos1);
+    fprintf(file, "offset\t%lld\n", (long long) offset);
+    for (std::map<std::string, uint32_t>::iterator i=counters.begin(); i!=counters.end(); ++i)
+    {
+        fprintf(file, "%s\t%u\n", i->first.c_str(), i->second);
+    }
+
+    if (fclose(file) || rename(temp_file.c_str(), checkpoint_file.c_str()))
+    {
+        fprintf(stderr, "[%s:%d %s] Cannot write checkpoint %s\n", __FILE__, __LINE__, __FUNCTION__, checkpoint_file.c_str());
+        exit(1);
+    }
+};
+
+/**
+ * Removes the checkpoint file.
+ */
+void Checkpoint::remove()
+{
+    ::remove(checkpoint_file.c_str());
+};
+
+/**
+ * Gets the intervals that remain to be processed from a list of intervals
+ * in the order of the contigs in a BAM header.  Reads ending just before
+ * the flushed position are included as they may carry hanging evidence.
+ *
+ * @intervals - intervals of the original run, empty for the whole genome
+ * @h         - BAM header
+ * @remaining - intervals that remain
+ */
+void Checkpoint::get_remaining_intervals(std::vector<GenomeInterval>& intervals, bam_hdr_t *h, std::vector<GenomeInterval>& remaining)
+{
+    if (intervals.empty())
+    {
+        std::vector<GenomeInterval> genome;
+        for (int32_t i=0; i<bam_hdr_get_n_targets(h); ++i)
+        {
+            genome.push_back(GenomeInterval(std::string(bam_hdr_get_target_name(h)[i])));
+        }
+        get_remaining_intervals(genome, remaining);
+    }
+    else
+    {
+        get_remaining_intervals(intervals, remaining);
+    }
+};
+
+/**
+ * Gets the intervals that remain to be processed from a list of intervals
+ * processed in order.  The first remaining interval starts just before the
+ * flushed position, records starting before the flushed position that
+ * are read from it have been written out.
+ *
+ * @intervals - intervals of the original run
+ * @remaining - intervals that remain
+ */
+void Checkpoint::get_remaining_intervals(std::vector<GenomeInterval>& intervals, std::vector<GenomeInterval>& remaining)
+{
+    remaining.clear();
+    int32_t resume_pos1 = std::max(flushed_pos1-1, 1);
+
+    bool found = false;
+    for (uint32_t i=0; i<intervals.size(); ++i)
+    {
+        if (found)
+        {
+            remaining.push_back(intervals[i]);
+        }
+        else if (intervals[i].seq==chrom && intervals[i].end1>=resume_pos1)
+        {
+            found = true;
+            remaining.push_back(GenomeInterval(intervals[i].seq, std::max(intervals[i].start1, resume_pos1), intervals[i].end1));
+        }
+    }
+};
+
+/**
+ * Sets a counter.
+ */
+void Checkpoint::set_counter(const char* key, uint32_t value)
+{
+    counters[key] = value;
+};
+
+/**
+ * Gets a counter, 0 if absent.
+ */
+uint32_t Checkpoint::get_counter(const char* key)
+{
+    std::map<std::string, uint32_t>::iterator i = counters.find(key);
+    return i==counters.end() ? 0 : i->second;
+};
@@ -0,0 +1,117 @@
+/* The MIT License
+
+   Copyright (c) 2014 Adrian Tan <atks@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include "htslib/sam.h"
+#include "hts_utils.h"
+#include "genome_interval.h"
+
+/**
+ * Checkpoint for resuming programs that stream through position ordered
+ * input and write position ordered output.
+ *
+ * A checkpoint records
+ * 1. the position up to which the output is complete,
+ * 2. the position of the next input record, all input records starting
+ *    before this have been processed and accounted for in the counters,
+ * 3. the offset of the end of the output file, see BCFOrderedWriter::checkpoint,
+ * 4. the counters of the program.
+ *
+ * The checkpoint is saved alongside the output file as <output>.ckpt.
+ */
+class Checkpoint
+{
+    public:
+
+    std::string checkpoint_file;
+
+    std::string chrom;
+    int32_t flushed_pos1;  //records at or after this position have not been written out
+    int32_t next_pos1;     //input records starting before this position have been processed
+    int64_t offset;        //offset of the end of the output
+    std::map<std::string, uint32_t> counters;
+
+    /**
+     * Constructor.
+     *
+     * @output_file - the output file being checkpointed
+     */
+    Checkpoint(std::string output_file);
+
+    /**
+     * Reads the checkpoint file, returns false if it does not exist or is invalid.
+     */
+    bool read();
+
+    /**
+     * Writes the checkpoint file, the previous checkpoint is replaced atomically.
+     */
+    void write();
+
+    /**
+     * Removes the checkpoint file.
+     */
+    void remove();
+
+    /**
+     * Gets the intervals that remain to be processed from a list of intervals
+     * in the order of the contigs in a BAM header.  Reads ending just before
+     * the flushed position are included as they may carry hanging evidence.
+     *
+     * @intervals - intervals of the original run, empty for the whole genome
+     * @h         - BAM header
+     * @remaining - intervals that remain
+     */
+    void get_remaining_intervals(std::vector<GenomeInterval>& intervals, bam_hdr_t *h, std::vector<GenomeInterval>& remaining);
+
+    /**
+     * Gets the intervals that remain to be processed from a list of intervals
+     * processed in order.  The first remaining interval starts just before the
+     * flushed position, records starting before the flushed position that
+     * are read from it have been written out.
+     *
+     * @intervals - intervals of the original run
+     * @remaining - intervals that remain
+     */
+    void get_remaining_intervals(std::vector<GenomeInterval>& intervals, std::vector<GenomeInterval>& remaining);
+
+    /**
+     * Sets a counter.
+     */
+    void set_counter(const char* key, uint32_t value);
+
+    /**
+     * Gets a counter, 0 if absent.
+     */
+    uint32_t get_counter(const char* key);
+};
+
+#endif
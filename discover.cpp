@@ -37,47 +37,98 @@ KHASH_MAP_INIT_STR(rdict, interval_t)
 #define MNP 2
 #define INDEL 4
 
+/**
+ * Interface for mining candidate variants.
+ */
+class AbstractVariantHunter
+{
+    public:
+    virtual ~AbstractVariantHunter() {};
+
+    /**
+     * Transfer read into a buffer for processing later
+     */
+    virtual void process_read(bam_hdr_t *h, bam1_t *s) = 0;
+
+    /**
+     * Processes buffer to pick up variants
+     */
+    virtual void extract_candidate_variants() = 0;
+
+    /**
+     * Gets the genome position on chrom before which all variants have been
+     * written out, pos0 is the position of the next read on chrom.  Variants
+     * still buffered on a previous chromosome are written out first.
+     */
+    virtual uint32_t get_flushed_pos0(const char* chrom, uint32_t pos0) = 0;
+
+    /**
+     * Suppresses variants on chrom before pos0 as they have already been
+     * written out in a previous run that is being resumed.
+     */
+    virtual void set_resume_pos0(const char* chrom, uint32_t pos0) = 0;
+};
+
 /**
  * Class for mining candidate variants.
  *
  * Processes an align read and records the variants observed against the reference
+ *
+ * VTYPE - combination of SNP, MNP and INDEL, evidence for variant types
+ *         not in VTYPE is neither collected nor stored.
  */
-class VariantHunter
+template <uint32_t VTYPE>
+class VariantHunter : public AbstractVariantHunter
 {
     public:
     /**
      * Constructor
      * baseq_cutoff - q value cutoff to select candidate SNPs
+     * evidence_depth_cap - maximum number of pieces of evidence of each type stored
+     *                      per position, evidence beyond this is reservoir sampled, 0 for no cap
      */
-    VariantHunter(uint32_t vtype,
-                  uint32_t evidence_allele_count_cutoff,
+    VariantHunter(uint32_t evidence_allele_count_cutoff,
                   double fractional_evidence_allele_count_cutoff,
                   uint32_t baseq_cutoff,
+                  uint32_t evidence_depth_cap,
                   faidx_t *fai,
                   BCFOrderedWriter *odw)
-    : vtype(vtype),
-      evidence_allele_count_cutoff(evidence_allele_count_cutoff),
-      fractional_evidence_allele_count_cutoff(fractional_evidence_allele_count_cutoff),
-      baseq_cutoff(baseq_cutoff),
-      fai(fai),
-      odw(odw),
-      buffer_size(800),
-      X(buffer_size),
-      Y(buffer_size),
-      I(buffer_size),
-      D(buffer_size),
+    : buffer_size(800),
+      X(VTYPE&SNP ? buffer_size : 0),
+      Y(VTYPE&MNP ? buffer_size : 0),
+      I(VTYPE&INDEL ? buffer_size : 0),
+      D(VTYPE&INDEL ? buffer_size : 0),
+      NX(VTYPE&SNP ? buffer_size : 0, 0),
+      NY(VTYPE&MNP ? buffer_size : 0, 0),
+      NI(VTYPE&INDEL ? buffer_size : 0, 0),
+      ND(VTYPE&INDEL ? buffer_size : 0, 0),
       N(buffer_size,0),
       REF(buffer_size),
-      ANCHOR(buffer_size),
+      ANCHOR(VTYPE&INDEL ? buffer_size : 0),
       chrom(0),
+      ref_window_beg0(0),
+      ref_window_chunk_size(65536),
+      ref_window_contig_len(0),
+      resume_pos0(0),
+      suppress_pos0(0),
       start(0), end(0),
       empty_buffer_space(0),
       min_empty_buffer_size(400),
       start_genome_pos0(0),
       max_used_buffer_size_threshold(buffer_size-min_empty_buffer_size),
       max_indel_length(50),
+      baseq_cutoff(baseq_cutoff),
+      evidence_depth_cap(evidence_depth_cap),
+      evidence_allele_count_cutoff(evidence_allele_count_cutoff),
+      fractional_evidence_allele_count_cutoff(fractional_evidence_allele_count_cutoff),
+      fai(fai),
+      odw(odw),
+      rb(odw->hdr),
       debug(false)
     {
+        E_tag = rb.add_format_tag("E");
+        N_tag = rb.add_format_tag("N");
+        ref_window = {0,0,0};
         alleles = {0,0,0};
         read_seq = {0,0,0};
         qual = {0,0,0};
@@ -95,7 +146,6 @@ class VariantHunter
         bam_get_seq_string(s, &read_seq);
         bam_get_cigar_expanded_string(s, &cigar);
         bam_get_qual_string(s, &qual);
-        int32_t ref_len;
         uint32_t q;
 
         //reset buffer if necessary
@@ -107,6 +157,9 @@ class VariantHunter
                 extract_candidate_variants(this->chrom, UINT_MAX);
                 free(this->chrom);
                 this->chrom = strdup(chrom);
+                ref_window.l = 0;
+                ref_window_contig_len = bam_hdr_get_target_len(h)[bam_get_tid(s)];
+                suppress_pos0 = 0;
             }
             else
             {
@@ -116,11 +169,14 @@ class VariantHunter
         else //first read
         {
             this->chrom = strdup(chrom);
+            ref_window_contig_len = bam_hdr_get_target_len(h)[bam_get_tid(s)];
+            suppress_pos0 = resume_chrom==chrom ? resume_pos0 : 0;
         }
 
         //basically equivalent to emptying the buffer
         extract_candidate_variants(chrom, pos0);
-        char* genome_seq = faidx_fetch_seq(fai, chrom, pos0-1, pos0+cigar.l, &ref_len);
+        update_ref_window(pos0-1, pos0+cigar.l);
+        const char* genome_seq = get_ref_seq(pos0-1);
         uint32_t genome_seq_pos0 = 1;
         uint32_t read_seq_pos0 = 0;
         uint32_t cur_pos0 = get_cur_pos0(pos0); //current buffer index
@@ -133,6 +189,10 @@ class VariantHunter
         char mnp_init_base = 'N';
         uint32_t ins_init_pos = 0;
         uint32_t del_init_pos = 0;
+        int32_t slot;
+        int32_t mnp_slot = -1;
+        int32_t ins_slot = -1;
+        int32_t del_slot = -1;
         if (0)
         {
             std::cerr << "===============\n";
@@ -166,27 +226,38 @@ class VariantHunter
 
                 if (genome_seq[genome_seq_pos0]!=read_seq.s[read_seq_pos0] && q>=baseq_cutoff)
                 {
-                    X[cur_pos0].push_back(read_seq.s[read_seq_pos0]);
-
-                    //initialize mnp
-                    if (last_position_had_snp && !mnp_allele_construction_in_progress)
+                    if (VTYPE&SNP)
                     {
-                        mnp_allele_construction_in_progress  = true;
-                        mnp_init_pos = last_snp_pos;
-                        last_position_had_snp = false;
-
-                        Y[mnp_init_pos].push_back("");
-                        Y[mnp_init_pos].back().append(1, mnp_init_base);
+                        if ((slot = reserve_evidence(X[cur_pos0], NX[cur_pos0], cur_pos0))>=0)
+                        {
+                            X[cur_pos0][slot] = read_seq.s[read_seq_pos0];
+                        }
                     }
 
-                    if (mnp_allele_construction_in_progress)
+                    if (VTYPE&MNP)
                     {
-                       Y[mnp_init_pos].back().append(1, read_seq.s[read_seq_pos0]);
-                    }
+                        //initialize mnp
+                        if (last_position_had_snp && !mnp_allele_construction_in_progress)
+                        {
+                            mnp_allele_construction_in_progress  = true;
+                            mnp_init_pos = last_snp_pos;
+                            last_position_had_snp = false;
+
+                            if ((mnp_slot = reserve_evidence(Y[mnp_init_pos], NY[mnp_init_pos], mnp_init_pos))>=0)
+                            {
+                                Y[mnp_init_pos][mnp_slot].append(1, mnp_init_base);
+                            }
+                        }
+
+                        if (mnp_allele_construction_in_progress && mnp_slot>=0)
+                        {
+                           Y[mnp_init_pos][mnp_slot].append(1, read_seq.s[read_seq_pos0]);
+                        }
 
-                    last_position_had_snp = true;
-                    last_snp_pos = cur_pos0;
-                    mnp_init_base = read_seq.s[read_seq_pos0];
+                        last_position_had_snp = true;
+                        last_snp_pos = cur_pos0;
+                        mnp_init_base = read_seq.s[read_seq_pos0];
+                    }
                 }
                 else
                 {
@@ -207,14 +278,22 @@ class VariantHunter
                 if (ins_init)
                 {
                     ins_init_pos = cur_pos0;
-                    I[ins_init_pos].push_back("");
-                    I[ins_init_pos].back().append(1, (read_seq_pos0!=0?read_seq.s[read_seq_pos0-1]:genome_seq[genome_seq_pos0-1]));
-                    ANCHOR[ins_init_pos] = genome_seq[genome_seq_pos0-1];
+                    if (VTYPE&INDEL)
+                    {
+                        if ((ins_slot = reserve_evidence(I[ins_init_pos], NI[ins_init_pos], ins_init_pos))>=0)
+                        {
+                            I[ins_init_pos][ins_slot].append(1, (read_seq_pos0!=0?read_seq.s[read_seq_pos0-1]:genome_seq[genome_seq_pos0-1]));
+                        }
+                        ANCHOR[ins_init_pos] = genome_seq[genome_seq_pos0-1];
+                    }
                 }
 
                 last_position_had_snp =false;
                 mnp_allele_construction_in_progress = false;
-                I[ins_init_pos].back().append(1, read_seq.s[read_seq_pos0]);
+                if ((VTYPE&INDEL) && ins_slot>=0)
+                {
+                    I[ins_init_pos][ins_slot].append(1, read_seq.s[read_seq_pos0]);
+                }
                 ins_init = false;
                 del_init = true;
 
@@ -231,12 +310,20 @@ class VariantHunter
                 if (del_init)
                 {
                     del_init_pos = cur_pos0;
-                    D[del_init_pos].push_back("");
-                    D[del_init_pos].back().append(1, (read_seq_pos0!=0?read_seq.s[read_seq_pos0-1]:genome_seq[genome_seq_pos0-1]));
+                    if (VTYPE&INDEL)
+                    {
+                        if ((del_slot = reserve_evidence(D[del_init_pos], ND[del_init_pos], del_init_pos))>=0)
+                        {
+                            D[del_init_pos][del_slot].append(1, (read_seq_pos0!=0?read_seq.s[read_seq_pos0-1]:genome_seq[genome_seq_pos0-1]));
+                        }
+                        ANCHOR[del_init_pos] = genome_seq[genome_seq_pos0-1];
+                    }
                     ++N[del_init_pos];
-                    ANCHOR[del_init_pos] = genome_seq[genome_seq_pos0-1];
                 }
-                D[del_init_pos].back().append(1, genome_seq[genome_seq_pos0]);
+                if ((VTYPE&INDEL) && del_slot>=0)
+                {
+                    D[del_init_pos][del_slot].append(1, genome_seq[genome_seq_pos0]);
+                }
 
                 last_position_had_snp =false;
                 mnp_allele_construction_in_progress = false;
@@ -251,8 +338,6 @@ class VariantHunter
             }
         }
 
-        if (ref_len>0) free(genome_seq);
-
         if (0)
         {
             std::cout << "final cur_pos0        : " << cur_pos0 << "\n";
@@ -273,6 +358,32 @@ class VariantHunter
         extract_candidate_variants(chrom, 0, true);
     };
 
+    /**
+     * Gets the genome position on chrom before which all variants have been
+     * written out, pos0 is the position of the next read on chrom.  Variants
+     * still buffered on a previous chromosome are written out first.
+     */
+    uint32_t get_flushed_pos0(const char* chrom, uint32_t pos0)
+    {
+        //the reads on chrom so far may all have been filtered
+        if (this->chrom && strcmp(this->chrom, chrom))
+        {
+            extract_candidate_variants(this->chrom, UINT_MAX);
+        }
+
+        return is_empty() ? pos0 : start_genome_pos0;
+    };
+
+    /**
+     * Suppresses variants on chrom before pos0 as they have already been
+     * written out in a previous run that is being resumed.
+     */
+    void set_resume_pos0(const char* chrom, uint32_t pos0)
+    {
+        resume_chrom = chrom;
+        resume_pos0 = pos0;
+    };
+
     private:
 
     uint32_t buffer_size;
@@ -280,12 +391,27 @@ class VariantHunter
     std::vector<std::vector<std::string> > Y; // contains multiple consecutive read bases that differ from the genome
     std::vector<std::vector<std::string> > I; //contains inserted bases
     std::vector<std::vector<std::string> > D; //contains reference bases that are deleted
+    std::vector<uint32_t> NX; // number of evidences observed for X, Y, I and D, including those not sampled
+    std::vector<uint32_t> NY;
+    std::vector<uint32_t> NI;
+    std::vector<uint32_t> ND;
     std::vector<int32_t> N; // number of evidences observed here - combination of X, I and D
     std::vector<char> REF;
     std::vector<char> ANCHOR;
     std::vector<std::string> ALT;
     char* chrom;
 
+    //reference sequence window for the current chromosome
+    kstring_t ref_window;
+    int32_t ref_window_beg0;
+    int32_t ref_window_chunk_size;
+    int32_t ref_window_contig_len;
+
+    //variants before this position on resume_chrom were written out before a resume
+    std::string resume_chrom;
+    uint32_t resume_pos0;
+    uint32_t suppress_pos0;
+
     //key control variables for circular buffer
     uint32_t start, end;
     uint32_t empty_buffer_space;
@@ -294,10 +420,10 @@ class VariantHunter
     uint32_t max_used_buffer_size_threshold;
     uint32_t max_indel_length;
     uint32_t baseq_cutoff;
+    uint32_t evidence_depth_cap;
     uint32_t evidence_allele_count_cutoff;
     double fractional_evidence_allele_count_cutoff;
     faidx_t *fai;
-    uint32_t vtype;
     kstring_t s;
     kstring_t alleles;
     kstring_t read_seq;
@@ -306,6 +432,9 @@ class VariantHunter
 
     bcf1_t *v;
     BCFOrderedWriter *odw;
+    BCFRecordBuilder rb;
+    int32_t E_tag;
+    int32_t N_tag;
     bool debug;
 
     /**
@@ -378,14 +507,13 @@ class VariantHunter
         std::map<std::string, int32_t> mnp_alts;
         std::map<std::string, int32_t> indel_alts;
         char anchor, ref;
-        int32_t ref_len;
         //print out candidate variants
         while (start!=stop)
         {
-            //assayed position
-            if (N[start]>=1)
+            //assayed position, skipping those written out before a resume
+            if (N[start]>=1 && start_genome_pos0>=suppress_pos0)
             {
-                if (vtype&INDEL)
+                if (VTYPE&INDEL)
                 {
                     //handling insertions
                     indel_alts.clear();
@@ -405,6 +533,8 @@ class VariantHunter
                             }
                         }
 
+                        scale_evidence(indel_alts, NI[start], I[start].size());
+
                         for (std::map<std::string, int32_t>::iterator i =indel_alts.begin(); i!=indel_alts.end(); ++i)
                         {
                             //make sure that we do not output alleles with N bases.
@@ -412,16 +542,17 @@ class VariantHunter
                                 ((double)i->second/(double) N[start]) >= fractional_evidence_allele_count_cutoff &&
                                 anchor!='N' && (i->first).find_first_of('N')==std::string::npos)
                             {
-                                v = odw->get_bcf1_from_pool();
-                                bcf_set_chrom(odw->hdr, v, chrom);
-                                bcf_set_pos1(v, start_genome_pos0);
+                                rb.set_chrom(chrom);
+                                rb.set_pos1(start_genome_pos0);
                                 alleles.l = 0;
                                 kputc(anchor, &alleles);
                                 kputc(',', &alleles);
                                 kputs(i->first.c_str(), &alleles);
-                                bcf_update_alleles_str(odw->hdr, v, alleles.s);
-                                bcf_update_format_int32(odw->hdr, v, "E", &i->second, 1);
-                                bcf_update_format_int32(odw->hdr, v, "N", &N[start], 1);
+                                rb.set_alleles(alleles.s);
+                                rb.set_format_int32(E_tag, &i->second, 1);
+                                rb.set_format_int32(N_tag, &N[start], 1);
+                                v = odw->get_bcf1_from_pool();
+                                rb.build(v);
                                 odw->write(v);
                             }
                         }
@@ -443,6 +574,8 @@ class VariantHunter
                             }
                         }
 
+                        scale_evidence(indel_alts, ND[start], D[start].size());
+
                         for (std::map<std::string, int32_t>::iterator i = indel_alts.begin(); i!= indel_alts.end(); ++i)
                         {
                             //make sure that we do not output alleles with N bases.
@@ -450,9 +583,8 @@ class VariantHunter
                                 ((double)i->second/(double) N[start]) >= fractional_evidence_allele_count_cutoff &&
                                 anchor!='N' && (i->first).find_first_of('N')==std::string::npos)
                             {
-                                v = odw->get_bcf1_from_pool();
-                                bcf_set_chrom(odw->hdr, v, chrom);
-                                bcf_set_pos1(v, start_genome_pos0);
+                                rb.set_chrom(chrom);
+                                rb.set_pos1(start_genome_pos0);
 
                                 alleles.l = 0;
                                 const char* deletedAllele = i->first.c_str();
@@ -462,16 +594,18 @@ class VariantHunter
                                 kputs(deletedAllele, &alleles);
                                 kputc(',', &alleles);
                                 kputc(replacement_anchor, &alleles);
-                                bcf_update_alleles_str(odw->hdr, v, alleles.s);
-                                bcf_update_format_int32(odw->hdr, v, "E", &i->second, 1);
-                                bcf_update_format_int32(odw->hdr, v, "N", &N[start], 1);
+                                rb.set_alleles(alleles.s);
+                                rb.set_format_int32(E_tag, &i->second, 1);
+                                rb.set_format_int32(N_tag, &N[start], 1);
+                                v = odw->get_bcf1_from_pool();
+                                rb.build(v);
                                 odw->write(v);
                             }
                         }
                     }
                 }
 
-                if (vtype&SNP)
+                if (VTYPE&SNP)
                 {
                     //handling SNPs
                     snp_alts.clear();
@@ -492,6 +626,8 @@ class VariantHunter
                             }
                         }
 
+                        scale_evidence(snp_alts, NX[start], X[start].size());
+
                         for (std::map<char, int32_t>::iterator i =snp_alts.begin(); i!=snp_alts.end(); ++i)
                         {
                             //make sure that we do not output alleles with N bases.
@@ -499,23 +635,24 @@ class VariantHunter
                                 ((double)i->second/(double) N[start]) >= fractional_evidence_allele_count_cutoff &&
                                 ref!='N' && (i->first)!='N')
                             {
-                                v = odw->get_bcf1_from_pool();
-                                bcf_set_chrom(odw->hdr, v, chrom);
-                                bcf_set_pos1(v, start_genome_pos0+1);
+                                rb.set_chrom(chrom);
+                                rb.set_pos1(start_genome_pos0+1);
                                 alleles.l = 0;
                                 kputc(ref, &alleles);
                                 kputc(',', &alleles);
                                 kputc(i->first, &alleles);
-                                bcf_update_alleles_str(odw->hdr, v, alleles.s);
-                                bcf_update_format_int32(odw->hdr, v, "E", &i->second, 1);
-                                bcf_update_format_int32(odw->hdr, v, "N", &N[start], 1);
+                                rb.set_alleles(alleles.s);
+                                rb.set_format_int32(E_tag, &i->second, 1);
+                                rb.set_format_int32(N_tag, &N[start], 1);
+                                v = odw->get_bcf1_from_pool();
+                                rb.build(v);
                                 odw->write(v);
                             }
                         }
                     }
                 }
 
-                if (vtype&MNP)
+                if (VTYPE&MNP)
                 {
                     //handling MNPs
                     mnp_alts.clear();
@@ -533,39 +670,53 @@ class VariantHunter
                             }
                         }
 
+                        scale_evidence(mnp_alts, NY[start], Y[start].size());
+
                         for (std::map<std::string, int32_t>::iterator i =mnp_alts.begin(); i!=mnp_alts.end(); ++i)
                         {
-                            char* seq = faidx_fetch_seq(fai, const_cast<char*>(chrom), start_genome_pos0, start_genome_pos0+i->first.size()-1, &ref_len);
+                            const char* seq = get_ref_seq(start_genome_pos0);
 
                             //make sure that we do not output alleles with N bases.
                             if (i->second>= evidence_allele_count_cutoff &&
                                 ((double)i->second/(double) N[start]) >= fractional_evidence_allele_count_cutoff &&
-                                !strchr(seq, 'N') && (i->first).find_first_of('N')==std::string::npos)
+                                !memchr(seq, 'N', i->first.size()) && (i->first).find_first_of('N')==std::string::npos)
                             {
-                                v = odw->get_bcf1_from_pool();
-                                bcf_set_chrom(odw->hdr, v, chrom);
-                                bcf_set_pos1(v, start_genome_pos0+1);
+                                rb.set_chrom(chrom);
+                                rb.set_pos1(start_genome_pos0+1);
                                 alleles.l = 0;
-                                kputc(anchor, &alleles);
+                                kputsn(seq, i->first.size(), &alleles);
                                 kputc(',', &alleles);
                                 kputs(i->first.c_str(), &alleles);
-                                bcf_update_alleles_str(odw->hdr, v, alleles.s);
-                                bcf_update_format_int32(odw->hdr, v, "E", &i->second, 1);
-                                bcf_update_format_int32(odw->hdr, v, "N", &N[start], 1);
+                                rb.set_alleles(alleles.s);
+                                rb.set_format_int32(E_tag, &i->second, 1);
+                                rb.set_format_int32(N_tag, &N[start], 1);
+                                v = odw->get_bcf1_from_pool();
+                                rb.build(v);
                                 odw->write(v);
                             }
-
-                            if (ref_len>0) free(seq);
                         }
                     }
                 }
 
             }
 
-            Y[start].clear();
-            X[start].clear();
-            I[start].clear();
-            D[start].clear();
+            if (VTYPE&MNP)
+            {
+                Y[start].clear();
+                NY[start] = 0;
+            }
+            if (VTYPE&SNP)
+            {
+                X[start].clear();
+                NX[start] = 0;
+            }
+            if (VTYPE&INDEL)
+            {
+                I[start].clear();
+                D[start].clear();
+                NI[start] = 0;
+                ND[start] = 0;
+            }
             N[start] = 0;
 
             add(start);
@@ -590,6 +741,131 @@ class VariantHunter
     //  }
     };
 
+    /**
+     * Ensures that the reference window covers [beg0,end0] on the current chromosome.
+     *
+     * The window starts no later than the first position held in the evidence
+     * buffer, bases that have been flushed out of the buffer are discarded and
+     * the window is extended forward in chunks so that overlapping reads do not
+     * refetch the same sequence.  A window that lies entirely behind the first
+     * position to keep is started afresh.  Positions off either end of the chromosome are
+     * represented by N.
+     */
+    void update_ref_window(int32_t beg0, int32_t end0)
+    {
+        int32_t keep0 = is_empty() ? beg0 : std::min(beg0, (int32_t)start_genome_pos0);
+
+        if (ref_window.l==0 || keep0<ref_window_beg0 || keep0>=ref_window_beg0+(int32_t)ref_window.l)
+        {
+            ref_window.l = 0;
+            ref_window_beg0 = keep0;
+        }
+        else if (keep0-ref_window_beg0>=ref_window_chunk_size)
+        {
+            uint32_t shift = keep0-ref_window_beg0;
+            memmove(ref_window.s, ref_window.s+shift, ref_window.l-shift);
+            ref_window.l -= shift;
+            ref_window.s[ref_window.l] = 0;
+            ref_window_beg0 = keep0;
+        }
+
+        int32_t window_end0 = ref_window_beg0 + (int32_t) ref_window.l;
+        if (end0<window_end0)
+        {
+            return;
+        }
+
+        while (window_end0<0 && window_end0<=end0)
+        {
+            kputc('N', &ref_window);
+            ++window_end0;
+        }
+
+        int32_t fetch_end0 = std::min(std::max(end0, window_end0+ref_window_chunk_size-1), ref_window_contig_len-1);
+        if (window_end0<=fetch_end0)
+        {
+            int32_t ref_len = 0;
+            char* seq = faidx_fetch_seq(fai, chrom, window_end0, fetch_end0, &ref_len);
+            if (ref_len>0)
+            {
+                kputsn(seq, ref_len, &ref_window);
+                window_end0 += ref_len;
+            }
+            if (seq) free(seq);
+        }
+
+        while (window_end0<=end0)
+        {
+            kputc('N', &ref_window);
+            ++window_end0;
+        }
+    };
+
+    /**
+     * Returns the reference sequence starting at genome position pos0,
+     * pos0 must lie within the reference window.
+     */
+    const char* get_ref_seq(int32_t pos0)
+    {
+        return ref_window.s + (pos0-ref_window_beg0);
+    };
+
+    /**
+     * Reserves a slot in the evidence list E at buffer index i for a new
+     * piece of evidence, n is the number of pieces of evidence observed so far.
+     *
+     * The cap applies to each evidence list separately, so a position may
+     * hold up to the cap for each of X, Y, I and D.  Each list is scaled
+     * back to its own observed count, so sampling one type does not bias
+     * the allele fractions of another.
+     *
+     * When a depth cap is set, the evidence is reservoir sampled, the slot
+     * to be replaced is drawn deterministically from the genome position
+     * and n so that results are reproducible.  Returns -1 if the evidence
+     * is not sampled.
+     */
+    template <class T>
+    int32_t reserve_evidence(std::vector<T>& E, uint32_t& n, uint32_t i)
+    {
+        uint32_t k = n++;
+
+        if (!evidence_depth_cap || E.size()<evidence_depth_cap)
+        {
+            E.push_back(T());
+            return E.size()-1;
+        }
+
+        //splitmix64 hash of genome position and evidence number
+        uint64_t z = (((uint64_t) (start_genome_pos0+diff(i,start)))<<32 | k) + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z>>30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z>>27)) * 0x94D049BB133111EBULL;
+        z ^= z>>31;
+
+        uint32_t j = z % (k+1);
+        if (j<evidence_depth_cap)
+        {
+            E[j] = T();
+            return j;
+        }
+
+        return -1;
+    };
+
+    /**
+     * Scales allele counts from sampled evidence to the number of pieces of evidence observed.
+     */
+    template <class T>
+    void scale_evidence(std::map<T, int32_t>& alts, uint32_t observed, uint32_t sampled)
+    {
+        if (observed>sampled)
+        {
+            for (typename std::map<T, int32_t>::iterator i=alts.begin(); i!=alts.end(); ++i)
+            {
+                i->second = (int32_t) round(((double) i->second*observed)/sampled);
+            }
+        }
+    };
+
     /**
      * Checks if buffer is empty
      */
@@ -701,14 +977,17 @@ class VariantHunter
         {
             std::cout << genome_pos << "\t" << cur_pos0 << "\t" << REF[cur_pos0] << "\t";
 
-            for (uint32_t j=0; j<I[cur_pos0].size(); ++j)
+            if (VTYPE&INDEL)
             {
-                std::cout << I[cur_pos0][j] << ",";
-            }
+                for (uint32_t j=0; j<I[cur_pos0].size(); ++j)
+                {
+                    std::cout << I[cur_pos0][j] << ",";
+                }
 
-            for (uint32_t j=0; j<D[cur_pos0].size(); ++j)
-            {
-                std::cout << D[cur_pos0][j] << ",";
+                for (uint32_t j=0; j<D[cur_pos0].size(); ++j)
+                {
+                    std::cout << D[cur_pos0][j] << ",";
+                }
             }
 
             std::cout << "\t" <<  N[cur_pos0] << "\n";
@@ -737,6 +1016,9 @@ class Igor : Program
     std::string variant_type;
     uint32_t evidence_allele_count_cutoff;
     double fractional_evidence_allele_count_cutoff;
+    uint32_t evidence_depth_cap;
+    uint32_t checkpoint_interval;
+    bool resume;
 
     uint16_t exclude_flag;
 
@@ -749,6 +1031,8 @@ class Igor : Program
     BCFOrderedWriter *odw;
     bcf1_t *v;
 
+    Checkpoint *checkpoint;
+
     /////////
     //stats//
     /////////
@@ -761,7 +1045,7 @@ class Igor : Program
     /////////
     //tools//
     /////////
-    VariantHunter *variantHunter;
+    AbstractVariantHunter *variantHunter;
 
     Igor(int argc, char **argv)
     {
@@ -785,8 +1069,11 @@ class Igor : Program
             TCLAP::ValueArg<uint32_t> arg_baseq_cutoff("q", "q", "base quality cutoff for bases [13]", false, 13, "int", cmd);
             TCLAP::ValueArg<uint32_t> arg_evidence_allele_count_cutoff("e", "e", "evidence count cutoff for candidate allele [2]", false, 2, "int", cmd);
             TCLAP::ValueArg<double> arg_fractional_evidence_allele_count_cutoff("f", "f", "fractional evidence cutoff for candidate allele [0.1]", false, 0.1, "float", cmd);
+            TCLAP::ValueArg<uint32_t> arg_evidence_depth_cap("c", "c", "maximum evidence depth per position for each of SNPs, MNPs, insertions and deletions, evidence is downsampled beyond this, 0 for no cap [0]", false, 0, "int", cmd);
             TCLAP::ValueArg<std::string> arg_variant_type("v", "v", "variant types [snps,mnps,indels]", false, "snps,mnps,indels", "str", cmd);
             TCLAP::ValueArg<std::string> arg_input_bam_file("b", "b", "input BAM file", true, "", "string", cmd);
+            TCLAP::ValueArg<uint32_t> arg_checkpoint_interval("k", "k", "number of reads between checkpoints saved to <output>.ckpt, 0 for no checkpoints [0]", false, 0, "int", cmd);
+            TCLAP::SwitchArg arg_resume("u", "resume", "resume from the checkpoint of an interrupted run [false]", cmd, false);
 
             cmd.parse(argc, argv);
 
@@ -800,6 +1087,9 @@ class Igor : Program
             variant_type = arg_variant_type.getValue();
             evidence_allele_count_cutoff = arg_evidence_allele_count_cutoff.getValue();
             fractional_evidence_allele_count_cutoff = arg_fractional_evidence_allele_count_cutoff.getValue();
+            evidence_depth_cap = arg_evidence_depth_cap.getValue();
+            checkpoint_interval = arg_checkpoint_interval.getValue();
+            resume = arg_resume.getValue();
         }
         catch (TCLAP::ArgException &e)
         {
@@ -818,7 +1108,43 @@ class Igor : Program
         odr = new BAMOrderedReader(input_bam_file, intervals);
         s = bam_init1();
 
-        odw = new BCFOrderedWriter(output_vcf_file, 0);
+        checkpoint = NULL;
+        if (checkpoint_interval || resume)
+        {
+            if (output_vcf_file=="-")
+            {
+                fprintf(stderr, "[%s:%d %s] checkpoints require an output file\n", __FILE__, __LINE__, __FUNCTION__);
+                exit(1);
+            }
+            checkpoint = new Checkpoint(output_vcf_file);
+        }
+
+        if (resume)
+        {
+            if (!checkpoint->read())
+            {
+                fprintf(stderr, "[%s:%d %s] cannot read checkpoint %s\n", __FILE__, __LINE__, __FUNCTION__, checkpoint->checkpoint_file.c_str());
+                exit(1);
+            }
+
+            //restrict reading to the reads that have not been written out
+            std::vector<GenomeInterval> remaining_intervals;
+            checkpoint->get_remaining_intervals(intervals, odr->hdr, remaining_intervals);
+            if (remaining_intervals.empty())
+            {
+                fprintf(stderr, "[%s:%d %s] checkpoint %s does not lie in the intervals\n", __FILE__, __LINE__, __FUNCTION__, checkpoint->checkpoint_file.c_str());
+                exit(1);
+            }
+            odr->close();
+            delete odr;
+            odr = new BAMOrderedReader(input_bam_file, remaining_intervals);
+
+            odw = new BCFOrderedWriter(output_vcf_file, 0, checkpoint->offset);
+        }
+        else
+        {
+            odw = new BCFOrderedWriter(output_vcf_file, 0);
+        }
         bam_hdr_transfer_contigs_to_bcf_hdr(odr->hdr, odw->hdr);
         bcf_hdr_append(odw->hdr, "##FORMAT=<ID=E,Number=1,Type=Integer,Description=\"Number of reads containing evidence of the alternate allele\">");
         bcf_hdr_append(odw->hdr, "##FORMAT=<ID=N,Number=1,Type=Integer,Description=\"Total number of reads at a candidate locus with reads that contain evidence of the alternate allele\">");
@@ -857,31 +1183,112 @@ class Igor : Program
         no_exclude_flag_reads = 0;
         no_low_mapq_reads = 0;
 
+        if (resume)
+        {
+            no_reads = checkpoint->get_counter("no_reads");
+            no_overlapping_reads = checkpoint->get_counter("no_overlapping_reads");
+            no_passed_reads = checkpoint->get_counter("no_passed_reads");
+            no_exclude_flag_reads = checkpoint->get_counter("no_exclude_flag_reads");
+            no_low_mapq_reads = checkpoint->get_counter("no_low_mapq_reads");
+        }
+
         ////////////////////////
         //tools initialization//
         ////////////////////////
         faidx_t *fai = fai_load(ref_fasta_file.c_str());
 
-        variantHunter = new VariantHunter(vtype,
-                                    evidence_allele_count_cutoff,
-                                    fractional_evidence_allele_count_cutoff,
-                                    baseq_cutoff,
-                                    fai,
-                                    odw);
+        switch (vtype)
+        {
+            case SNP:
+                variantHunter = new VariantHunter<SNP>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            case MNP:
+                variantHunter = new VariantHunter<MNP>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            case INDEL:
+                variantHunter = new VariantHunter<INDEL>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            case SNP|MNP:
+                variantHunter = new VariantHunter<SNP|MNP>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            case SNP|INDEL:
+                variantHunter = new VariantHunter<SNP|INDEL>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            case MNP|INDEL:
+                variantHunter = new VariantHunter<MNP|INDEL>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            case SNP|MNP|INDEL:
+                variantHunter = new VariantHunter<SNP|MNP|INDEL>(evidence_allele_count_cutoff, fractional_evidence_allele_count_cutoff, baseq_cutoff, evidence_depth_cap, fai, odw);
+                break;
+            default:
+                fprintf(stderr, "[%s:%d %s] no valid variant type selected: %s\n", __FILE__, __LINE__, __FUNCTION__, variant_type.c_str());
+                exit(1);
+        }
+
+        if (resume)
+        {
+            variantHunter->set_resume_pos0(checkpoint->chrom.c_str(), checkpoint->flushed_pos1-1);
+        }
     }
 
     void discover()
     {
-        odw->write_hdr();
-
         //for tracking overlapping reads
         khash_t(rdict) *reads = kh_init(rdict);
         khiter_t k;
         int32_t ret;
 
+        //for checkpointing, reads before replay_pos0 on replay_tid
+        //were accounted for in the run being resumed
+        int32_t last_tid = -1;
+        int32_t last_pos0 = -1;
+        uint32_t last_checkpoint_no_reads = 0;
+        int32_t replay_tid = -1;
+        int32_t replay_pos0 = -1;
+        bool replay = false;
+
+        if (resume)
+        {
+            replay_tid = bam_name2id(odr->hdr, checkpoint->chrom.c_str());
+            replay_pos0 = checkpoint->next_pos1-1;
+            last_checkpoint_no_reads = no_reads;
+        }
+        else
+        {
+            odw->write_hdr();
+        }
+
         while (odr->read(s))
         {
-            ++no_reads;
+            int32_t tid = bam_get_tid(s);
+            int32_t pos0 = bam_get_pos0(s);
+            replay = tid==replay_tid && pos0<replay_pos0;
+
+            //all reads before this one have been processed
+            if (checkpoint_interval && !replay &&
+                no_reads-last_checkpoint_no_reads>=checkpoint_interval &&
+                tid==last_tid && pos0>last_pos0)
+            {
+                checkpoint->chrom = bam_get_chrom(odr->hdr, s);
+                checkpoint->flushed_pos1 = variantHunter->get_flushed_pos0(checkpoint->chrom.c_str(), pos0)+1;
+                checkpoint->next_pos1 = pos0+1;
+                if ((checkpoint->offset = odw->checkpoint())<0)
+                {
+                    fprintf(stderr, "[%s:%d %s] cannot flush %s for checkpoint\n", __FILE__, __LINE__, __FUNCTION__, output_vcf_file.c_str());
+                    exit(1);
+                }
+                checkpoint->set_counter("no_reads", no_reads);
+                checkpoint->set_counter("no_overlapping_reads", no_overlapping_reads);
+                checkpoint->set_counter("no_passed_reads", no_passed_reads);
+                checkpoint->set_counter("no_exclude_flag_reads", no_exclude_flag_reads);
+                checkpoint->set_counter("no_low_mapq_reads", no_low_mapq_reads);
+                checkpoint->write();
+                last_checkpoint_no_reads = no_reads;
+            }
+            last_tid = tid;
+            last_pos0 = pos0;
+
+            if (!replay) ++no_reads;
 
             //this read is the first of the pair
             if (bam_get_mpos1(s) && (bam_get_tid(s)==bam_get_mtid(s)))
@@ -914,7 +1321,7 @@ class Igor : Program
                         {
                             free((char*)kh_key(reads, k));
                             kh_del(rdict, reads, k);
-                            ++no_overlapping_reads;
+                            if (!replay) ++no_overlapping_reads;
                         }
                         //continue;
                     }
@@ -927,14 +1334,14 @@ class Igor : Program
                 //2. secondary alignment
                 //3. not passing QC
                 //4. PCR or optical duplicate
-                ++no_exclude_flag_reads;
+                if (!replay) ++no_exclude_flag_reads;
                 continue;
             }
 
             if (bam_get_mapq(s) < mapq_cutoff)
             {
                 //filter short aligments and those with too many indels (?)
-                ++no_low_mapq_reads;
+                if (!replay) ++no_low_mapq_reads;
                 continue;
             }
 
@@ -947,11 +1354,17 @@ class Igor : Program
 
 //          if (no_reads%100000==0) std::cerr << no_reads << "\n";
 
-            ++no_passed_reads;
+            if (!replay) ++no_passed_reads;
         }
 
+        variantHunter->extract_candidate_variants();
         odw->close();
 
+        if (checkpoint)
+        {
+            checkpoint->remove();
+        }
+
     };
 
     void bam_print(bam1_t *s)
@@ -1001,6 +1414,9 @@ class Igor : Program
         std::clog << "         [v] variant type(s)              " << variant_type << "\n";
         std::clog << "         [e] evidence cutoff              " << evidence_allele_count_cutoff << "\n";
         std::clog << "         [f] fractional evidence cutoff   " << fractional_evidence_allele_count_cutoff<< "\n";
+        std::clog << "         [c] evidence depth cap           " << evidence_depth_cap << "\n";
+        std::clog << "         [k] checkpoint interval          " << checkpoint_interval << "\n";
+        std::clog << "         [u] resume                       " << (resume ? "yes" : "no") << "\n";
         print_int_op("         [i] intervals                    ", intervals);
         std::clog << "\n";
 
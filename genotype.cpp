@@ -23,6 +23,12 @@
 
 #include "genotype.h"
 
+//maximum length of a window of candidate sites whose reads are fetched together with -c
+#define GENOTYPE_MAX_WINDOW_LENGTH 100000
+
+//number of candidate sites at the start of an interval used to decide if it is swept with -c
+#define GENOTYPE_DENSITY_SAMPLE_SIZE 1024
+
 namespace
 {
 
@@ -37,31 +43,65 @@ class Igor : Program
     ///////////
     std::string sample_id;
     std::string input_vcf_file;
-    std::string input_sam_file;
+    std::vector<std::string> input_sam_files;
     std::string output_vcf_file;
     std::vector<GenomeInterval> intervals;
     bool iterate_by_site;
+    uint32_t window_gap;
+    uint32_t no_threads;
+    uint32_t kmer_size;
+    uint32_t kmer_min_qual;
+    bool quantized;
+    std::string ref_fasta_file;
+    uint32_t min_flank_length;
+    uint32_t checkpoint_interval;
+    bool resume;
     bool debug;
 
     ///////
     //i/o//
     ///////
     BCFOrderedReader *vodr;
-    BAMOrderedReader *sodr;
+    std::vector<BAMOrderedReader*> sodrs;
+    std::vector<int32_t> sample_indices; //sample of each BAM file
     BCFOrderedWriter *vodw;
     bcf1_t *v;
-    bam1_t *s;
+    std::vector<bam1_t*> s; //next read of each BAM file
+    GenotypingBuffer *buffer; //sweeps the reads over the candidate sites, NULL without an index
+
+    //candidate sites on resume_rid before resume_pos1 were written out before a resume
+    Checkpoint *checkpoint;
+    int32_t resume_rid;
+    int32_t resume_pos1;
+    uint32_t no_reads_since_checkpoint;
+
+    //with -c, the records of a window of sites and its reads, decoded on first use
+    std::vector<LHMMGenotypingRecord*> window;
+    std::vector<bam1_t*> window_reads;
+    std::vector<GenotypingRead*> decoded_reads;
 
     /////////
     //stats//
     /////////
     uint32_t no_snps_genotyped;
     uint32_t no_indels_genotyped;
+    uint32_t no_alignments;
+    uint32_t no_cached_alignments;
+    uint32_t no_stitched;
+    uint32_t no_prefiltered;
+    uint32_t no_prefilter_discordances;
+    uint32_t no_quantized_alignments;
+    uint32_t no_quantization_violations;
+    double max_quantization_error;
+    uint32_t no_windows;
+    uint32_t no_dense_intervals;
 
     /////////
     //tools//
     /////////
-   
+    ProbeCache *probe_cache;
+    LHMM lhmm;
+
     Igor(int argc, char ** argv)
     {
         //////////////////////////
@@ -69,28 +109,59 @@ class Igor : Program
         //////////////////////////
         try
         {
-            std::string desc = "Genotypes SNPs and Indels for a sample\n";
+            std::string desc = "Genotypes SNPs and Indels for one or more samples\n\n"
+                 "The sample of each BAM file is taken from the SM tag of its first read group,\n"
+                 "BAM files of the same sample are pooled.\n";
 
             version = "0.57";
             TCLAP::CmdLine cmd(desc, ' ', version);
             VTOutput my; cmd.setOutput(&my);
             TCLAP::ValueArg<std::string> arg_intervals("i", "i", "intervals", false, "", "str", cmd);
             TCLAP::ValueArg<std::string> arg_interval_list("I", "I", "file containing list of intervals []", false, "", "str", cmd);
-            TCLAP::ValueArg<std::string> arg_input_sam_file("b", "b", "input BAM file", true, "", "str", cmd);
+            TCLAP::ValueArg<std::string> arg_input_sam_file("b", "b", "input BAM file", false, "", "str", cmd);
+            TCLAP::ValueArg<std::string> arg_input_sam_file_list("L", "L", "file containing list of input BAM files", false, "", "str", cmd);
             TCLAP::ValueArg<std::string> arg_output_vcf_file("o", "o", "output VCF file", false, "-", "file", cmd);
-            TCLAP::ValueArg<std::string> arg_sample_id("s", "s", "sample ID", true, "", "str", cmd);
-            TCLAP::SwitchArg arg_iterate_by_site("c", "c", "iterate by candidate sites", cmd, false);
-            TCLAP::SwitchArg arg_debug("d", "d", "debug alignments", cmd, false);
+            TCLAP::ValueArg<std::string> arg_sample_id("s", "s", "sample ID, overrides the SM tag when there is one BAM file", false, "", "str", cmd);
+            TCLAP::SwitchArg arg_iterate_by_site("c", "c", "iterate by candidate sites, the reads of nearby sites are fetched together and dense sites are swept, the input VCF need not be indexed", cmd, false);
+            TCLAP::ValueArg<uint32_t> arg_window_gap("w", "w", "maximum distance between candidate sites fetched together with -c [1000]", false, 1000, "int", cmd);
+            TCLAP::ValueArg<uint32_t> arg_no_threads("t", "t", "number of threads for genotyping indels [1]", false, 1, "int", cmd);
+            TCLAP::ValueArg<uint32_t> arg_kmer_size("k", "k", "k-mer size of the prefilter that skips aligning reads with all the k-mers of only one allele, 0 to disable [0]", false, 0, "int", cmd);
+            TCLAP::ValueArg<uint32_t> arg_kmer_min_qual("q", "q", "minimum base quality of k-mers used by the prefilter [20]", false, 20, "int", cmd);
+            TCLAP::SwitchArg arg_quantized("a", "a", "align the reads of indels with 16 bit quantized scores where they fit, reads up to 207bp with qualities from 1 to 94, faster but a log10 likelihood may be off by up to (probe length + 2 x read length)/256 [false]", cmd, false);
+            TCLAP::ValueArg<std::string> arg_ref_fasta_file("r", "r", "reference sequence fasta file for generating the probes of indels without REFPROBE and ALTPROBE []", false, "", "str", cmd);
+            TCLAP::ValueArg<uint32_t> arg_min_flank_length("f", "f", "minimum flank length of generated probes [20]", false, 20, "int", cmd);
+            TCLAP::ValueArg<uint32_t> arg_checkpoint_interval("K", "K", "number of reads between checkpoints saved to <output>.ckpt, 0 for no checkpoints [0]", false, 0, "int", cmd);
+            TCLAP::SwitchArg arg_resume("u", "resume", "resume from the checkpoint of an interrupted run [false]", cmd, false);
+            TCLAP::SwitchArg arg_debug("d", "d", "debug alignments, audits the prefilter and the quantized alignments against the alignments", cmd, false);
             TCLAP::UnlabeledValueArg<std::string> arg_input_vcf_file("<in.vcf>", "input VCF file", true, "","file", cmd);
 
             cmd.parse(argc, argv);
 
             input_vcf_file = arg_input_vcf_file.getValue();
-            input_sam_file = arg_input_sam_file.getValue();
+            std::vector<std::string> arg_input_sam_files;
+            if (arg_input_sam_file.getValue()!="")
+            {
+                arg_input_sam_files.push_back(arg_input_sam_file.getValue());
+            }
+            parse_files(input_sam_files, arg_input_sam_files, arg_input_sam_file_list.getValue());
+            if (input_sam_files.empty())
+            {
+                fprintf(stderr, "[E:%s:%d %s] no input BAM files, use -b or -L\n", __FILE__, __LINE__, __FUNCTION__);
+                exit(1);
+            }
             output_vcf_file = arg_output_vcf_file.getValue();
             sample_id = arg_sample_id.getValue();
             parse_intervals(intervals, arg_interval_list.getValue(), arg_intervals.getValue());
             iterate_by_site = arg_iterate_by_site.getValue();
+            window_gap = arg_window_gap.getValue();
+            no_threads = arg_no_threads.getValue();
+            kmer_size = arg_kmer_size.getValue();
+            kmer_min_qual = arg_kmer_min_qual.getValue();
+            quantized = arg_quantized.getValue();
+            ref_fasta_file = arg_ref_fasta_file.getValue();
+            min_flank_length = arg_min_flank_length.getValue();
+            checkpoint_interval = arg_checkpoint_interval.getValue();
+            resume = arg_resume.getValue();
             debug = arg_debug.getValue();
         }
         catch (TCLAP::ArgException &e)
@@ -102,6 +173,8 @@ class Igor : Program
 
     ~Igor()
     {
+        if (probe_cache) delete probe_cache;
+        if (checkpoint) delete checkpoint;
     };
 
     void print_options()
@@ -109,10 +182,23 @@ class Igor : Program
         std::clog << "genotype v" << version << "\n\n";
 
         std::clog << "options:     input VCF file        " << input_vcf_file << "\n";
-        std::clog << "         [b] input BAM file        " << input_sam_file << "\n";
+        print_ifiles("         [b] input BAM files       ", input_sam_files);
         std::clog << "         [o] output VCF file       " << output_vcf_file << "\n";
         std::clog << "         [c] iterate by site       " << (iterate_by_site ? "yes" : "no") << "\n";
-        std::clog << "         [s] sample ID             " << sample_id << "\n";
+        if (iterate_by_site) std::clog << "         [w] window gap            " << window_gap << "\n";
+        if (sample_id!="") std::clog << "         [s] sample ID             " << sample_id << "\n";
+        std::clog << "         [t] no. of threads        " << no_threads << "\n";
+        std::clog << "         [k] prefilter k-mer size  " << kmer_size << "\n";
+        if (kmer_size) std::clog << "         [q] prefilter min qual    " << kmer_min_qual << "\n";
+        std::clog << "         [a] quantized alignment   " << (quantized ? "yes" : "no") << "\n";
+        if (ref_fasta_file!="")
+        {
+            std::clog << "         [r] reference FASTA file  " << ref_fasta_file << "\n";
+            std::clog << "         [f] minimum flank length  " << min_flank_length << "\n";
+        }
+        std::clog << "         [K] checkpoint interval   " << checkpoint_interval << "\n";
+        std::clog << "         [u] resume                " << (resume ? "yes" : "no") << "\n";
+        std::clog << "         [d] debug                 " << (debug ? "yes" : "no") << "\n";
         print_int_op("         [i] intervals             ", intervals);
         std::clog << "\n";
     }
@@ -123,20 +209,127 @@ class Igor : Program
         //i/o initialization//
         //////////////////////
         vodr = new BCFOrderedReader(input_vcf_file, intervals);
-        sodr = new BAMOrderedReader(input_sam_file, intervals);
-        vodw = new BCFOrderedWriter(output_vcf_file, 0);
-        bcf_hdr_add_sample(vodw->hdr, sample_id.c_str());
+        if (!iterate_by_site && !vodr->index_loaded)
+        {
+            fprintf(stderr, "[E:%s:%d %s] index required for %s, or use -c to read it in one pass\n", __FILE__, __LINE__, __FUNCTION__, input_vcf_file.c_str());
+            exit(1);
+        }
+        if (bcf_hdr_nsamples(vodr->hdr))
+        {
+            fprintf(stderr, "[E:%s:%d %s] %s already has samples, genotype a sites only VCF\n", __FILE__, __LINE__, __FUNCTION__, input_vcf_file.c_str());
+            exit(1);
+        }
 
-        //////////////////////
-        //tool initialization//
-        //////////////////////
-        
+        checkpoint = NULL;
+        resume_rid = -1;
+        resume_pos1 = 0;
+        no_reads_since_checkpoint = 0;
+        if (checkpoint_interval || resume)
+        {
+            if (output_vcf_file=="-")
+            {
+                fprintf(stderr, "[E:%s:%d %s] checkpoints require an output file\n", __FILE__, __LINE__, __FUNCTION__);
+                exit(1);
+            }
+            checkpoint = new Checkpoint(output_vcf_file);
+        }
+
+        if (resume)
+        {
+            if (!checkpoint->read())
+            {
+                fprintf(stderr, "[E:%s:%d %s] cannot read checkpoint %s\n", __FILE__, __LINE__, __FUNCTION__, checkpoint->checkpoint_file.c_str());
+                exit(1);
+            }
+
+            if ((resume_rid = bcf_hdr_name2id(vodr->hdr, checkpoint->chrom.c_str()))<0)
+            {
+                fprintf(stderr, "[E:%s:%d %s] checkpoint %s is on %s, which is not in %s\n", __FILE__, __LINE__, __FUNCTION__, checkpoint->checkpoint_file.c_str(), checkpoint->chrom.c_str(), input_vcf_file.c_str());
+                exit(1);
+            }
+            resume_pos1 = checkpoint->flushed_pos1;
+
+            //the records written out before the checkpoint are kept
+            vodw = new BCFOrderedWriter(output_vcf_file, 0, checkpoint->offset);
+        }
+        else
+        {
+            vodw = new BCFOrderedWriter(output_vcf_file, 0);
+        }
+        vodw->set_hdr(vodr->hdr);
+
+        kstring_t sample = {0,0,0};
+        for (uint32_t i=0; i<input_sam_files.size(); ++i)
+        {
+            sodrs.push_back(new BAMOrderedReader(input_sam_files[i], intervals));
+            s.push_back(bam_init1());
+
+            if (sample_id!="" && input_sam_files.size()==1)
+            {
+                sample.l = 0;
+                kputs(sample_id.c_str(), &sample);
+            }
+            else
+            {
+                bam_hdr_get_sample_name(sodrs[i]->hdr, &sample);
+                if (!sample.l)
+                {
+                    fprintf(stderr, "[E:%s:%d %s] no SM tag in the read groups of %s\n", __FILE__, __LINE__, __FUNCTION__, input_sam_files[i].c_str());
+                    exit(1);
+                }
+            }
+
+            if (bcf_hdr_id2int(vodw->hdr, BCF_DT_SAMPLE, sample.s)==-1)
+            {
+                bcf_hdr_add_sample(vodw->hdr, sample.s);
+            }
+            sample_indices.push_back(bcf_hdr_id2int(vodw->hdr, BCF_DT_SAMPLE, sample.s));
+        }
+        if (sample.m) free(sample.s);
+
+        bcf_hdr_append(vodw->hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">");
+        bcf_hdr_append(vodw->hdr, "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Normalized, Phred-scaled likelihoods for genotypes\">");
+        bcf_hdr_append(vodw->hdr, "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Number of reads genotyped\">");
+        if (!resume)
+        {
+            vodw->write_hdr();
+        }
+
+        ////////////////////////
+        //tools initialization//
+        ////////////////////////
+        probe_cache = ref_fasta_file!="" ? new ProbeCache(ref_fasta_file, min_flank_length) : NULL;
 
         ////////////////////////
         //stats initialization//
         ////////////////////////
         no_snps_genotyped = 0;
         no_indels_genotyped = 0;
+        no_alignments = 0;
+        no_cached_alignments = 0;
+        no_stitched = 0;
+        no_prefiltered = 0;
+        no_prefilter_discordances = 0;
+        no_quantized_alignments = 0;
+        no_quantization_violations = 0;
+        max_quantization_error = 0;
+        no_windows = 0;
+        no_dense_intervals = 0;
+
+        //the stats of the records written out before the checkpoint, the windows,
+        //dense intervals and the largest quantization error are those of this run
+        if (resume)
+        {
+            no_snps_genotyped = checkpoint->get_counter("no_snps_genotyped");
+            no_indels_genotyped = checkpoint->get_counter("no_indels_genotyped");
+            no_alignments = checkpoint->get_counter("no_alignments");
+            no_cached_alignments = checkpoint->get_counter("no_cached_alignments");
+            no_stitched = checkpoint->get_counter("no_stitched");
+            no_prefiltered = checkpoint->get_counter("no_prefiltered");
+            no_prefilter_discordances = checkpoint->get_counter("no_prefilter_discordances");
+            no_quantized_alignments = checkpoint->get_counter("no_quantized_alignments");
+            no_quantization_violations = checkpoint->get_counter("no_quantization_violations");
+        }
     }
 
     void print_stats()
@@ -144,128 +337,467 @@ class Igor : Program
         std::clog << "\n";
         std::clog << "Stats: SNPs genotyped     " << no_snps_genotyped << "\n";
         std::clog << "       Indels genotyped   " << no_indels_genotyped << "\n";
+        uint32_t no_reads_aligned = no_alignments+no_cached_alignments;
+        std::clog << "       Stitched mates     " << no_stitched << "\n";
+        std::clog << "       Reads aligned      " << no_reads_aligned << "\n";
+        //only reads with identical sequence and quality classes share alignments,
+        //mostly duplicates with binned qualities, next to none with unbinned qualities
+        fprintf(stderr, "       Cached alignments  %d [%.2f%%] of reads identical in sequence and qualities\n", no_cached_alignments, no_reads_aligned ? 100.0*no_cached_alignments/no_reads_aligned : 0);
+        if (kmer_size)
+        {
+            std::clog << "       Prefiltered reads  " << no_prefiltered << "\n";
+            if (debug)
+            {
+                double rate = no_prefiltered ? (double) no_prefilter_discordances/no_prefiltered : 0;
+                fprintf(stderr, "       Discordances       %d [%.2f%%]\n", no_prefilter_discordances, 100*rate);
+                if (rate>LHMM_GENOTYPING_PREFILTER_MAX_DISCORDANCE)
+                {
+                    fprintf(stderr, "[W:%s:%d %s] %.2f%% of the prefiltered reads are discordant with their alignments, more than %.2f%%, consider a larger -k or -q\n",
+                            __FILE__, __LINE__, __FUNCTION__, 100*rate, 100*LHMM_GENOTYPING_PREFILTER_MAX_DISCORDANCE);
+                }
+            }
+        }
+        if (quantized)
+        {
+            std::clog << "       Quantized reads    " << no_quantized_alignments << "\n";
+            if (debug)
+            {
+                fprintf(stderr, "       Quantization error %f\n", max_quantization_error);
+                std::clog << "       Over error bound   " << no_quantization_violations << "\n";
+            }
+        }
+        if (iterate_by_site)
+        {
+            std::clog << "       Windows fetched    " << no_windows << "\n";
+            std::clog << "       Dense intervals    " << no_dense_intervals << "\n";
+        }
+        if (probe_cache)
+        {
+            std::clog << "       Probes generated   " << probe_cache->no_probes_generated << "\n";
+            std::clog << "       Cached probes      " << probe_cache->no_cached_probes << "\n";
+        }
         std::clog << "\n";
     }
 
     void genotype()
     {
-        if (iterate_by_site)
-        {   
-//            GenotypingRecord record;
-//            bcf1_t *v = vodw->get_bcf1_from_pool();
-//            bam1_t *s = bam_init1();
-//            while (vodr->read(v))
-//            {
-//                record.set(vodr->hdr, v);
-//                
-//                std::string chrom(bcf_get_chrom(vodr->hdr, v));
-//                GenomeInterval interval(chrom, bcf_get_pos1(v), bcf_get_pos1(v));
-//                sodr->jump_to_interval(interval);
-//                while(sodr->read(s))
-//                {
-//                    record.genotype(s, 0);
-//                }
-//                
-//                record.print(vodw);
-//            }
+        buffer = NULL;
+        if (iterate_by_site && !vodr->index_loaded)
+        {
+            //without an index, the candidate sites are read in one pass
+            genotype_by_windows();
+        }
+        else
+        {
+            //sweep each chromosome in one pass, jumping once per interval
+            std::vector<GenomeInterval> sweep_intervals = intervals;
+            if (sweep_intervals.empty())
+            {
+                int32_t nseqs;
+                const char** seqs = bcf_hdr_seqnames(vodr->hdr, &nseqs);
+                for (int32_t i=0; i<nseqs; ++i)
+                {
+                    sweep_intervals.push_back(GenomeInterval(std::string(seqs[i])));
+                }
+                free(seqs);
+            }
+
+            if (resume)
+            {
+                std::vector<GenomeInterval> remaining_intervals;
+                checkpoint->get_remaining_intervals(sweep_intervals, remaining_intervals);
+                if (remaining_intervals.empty())
+                {
+                    fprintf(stderr, "[E:%s:%d %s] checkpoint %s does not lie in the intervals\n", __FILE__, __LINE__, __FUNCTION__, checkpoint->checkpoint_file.c_str());
+                    exit(1);
+                }
+                sweep_intervals.swap(remaining_intervals);
+            }
+
+            //the sweep runs on this thread, the other threads genotype indels
+            buffer = new GenotypingBuffer(vodr, vodw, no_threads>1 ? no_threads-1 : 0);
+            buffer->set_prefilter(kmer_size, kmer_min_qual, debug);
+            buffer->set_quantized(quantized, debug);
+            buffer->set_probe_cache(probe_cache);
+            buffer->set_resume_pos1(resume_rid, resume_pos1);
+            for (uint32_t i=0; i<sweep_intervals.size(); ++i)
+            {
+                if (!vodr->jump_to_interval(sweep_intervals[i]))
+                {
+                    continue;
+                }
+
+                //sparse candidate sites are fetched window by window
+                if (iterate_by_site)
+                {
+                    bool dense = is_dense();
+                    vodr->jump_to_interval(sweep_intervals[i]);
+                    if (!dense)
+                    {
+                        genotype_by_windows();
+                        continue;
+                    }
+
+                    ++no_dense_intervals;
+                }
+
+                //merge the reads of all the BAM files by position
+                std::priority_queue<std::pair<int32_t, uint32_t>,
+                                    std::vector<std::pair<int32_t, uint32_t> >,
+                                    std::greater<std::pair<int32_t, uint32_t> > > heads;
+                for (uint32_t j=0; j<sodrs.size(); ++j)
+                {
+                    if (sodrs[j]->jump_to_interval(sweep_intervals[i]) && sodrs[j]->read(s[j]))
+                    {
+                        heads.push(std::make_pair(bam_get_pos0(s[j]), j));
+                    }
+                }
+
+                while (!heads.empty())
+                {
+                    uint32_t j = heads.top().second;
+                    heads.pop();
+
+                    buffer->process_read(s[j], sample_indices[j]);
+
+                    //every record before the first one not printed out has been written out
+                    int32_t rid, pos1;
+                    if (checkpoint_interval &&
+                        ++no_reads_since_checkpoint>=checkpoint_interval &&
+                        buffer->get_unprinted_pos1(rid, pos1))
+                    {
+                        save_checkpoint(rid, pos1);
+                    }
+
+                    if (sodrs[j]->read(s[j]))
+                    {
+                        heads.push(std::make_pair(bam_get_pos0(s[j]), j));
+                    }
+                }
+
+                buffer->flush();
+            }
+
+            no_snps_genotyped += buffer->no_snps_genotyped;
+            no_indels_genotyped += buffer->no_indels_genotyped;
+            no_alignments += buffer->no_alignments;
+            no_cached_alignments += buffer->no_cached_alignments;
+            no_stitched += buffer->no_stitched;
+            no_prefiltered += buffer->no_prefiltered;
+            no_prefilter_discordances += buffer->no_prefilter_discordances;
+            no_quantized_alignments += buffer->no_quantized_alignments;
+            no_quantization_violations += buffer->no_quantization_violations;
+            max_quantization_error = std::max(max_quantization_error, buffer->max_quantization_error);
+            delete buffer;
+            buffer = NULL;
         }
-        else //iterate by reads
+
+        vodw->close();
+        if (checkpoint)
+        {
+            checkpoint->remove();
+        }
+        for (uint32_t i=0; i<sodrs.size(); ++i)
         {
-            
-            
-            
-            //get reads from bam
-                    //let VCFPool process reads
-            
-//            //pick up chromosomes from bam and vcf
-//            //hash table for sequences
-//            khash_t(sdict) *h = kh_init(sdict);
-//            khiter_t k;
-//            int32_t success;
-//            if (intervals.empty())
-//            {
-//                kstring_t s = {0,0,0};
-//                char** seqs = bam_hdr_get_target_name(sodr->hdr);
-//                for (uint32_t i=0; i<bam_hdr_get_n_targets(sodr->hdr); ++i)
-//                {
-//                    if (kh_get(sdict, h, seqs[i])==kh_end(h))
-//                    {
-//                        char* seq = strdup(seqs[i]);
-//                        k = kh_put(sdict, h, seq, &success);
-//                        if (!success)
-//                        {
-//                            intervals.push_back(GenomeInterval(std::string(seq)));
-//                        }
-//                        else
-//                        {
-//                            free(seq);
-//                        }
-//                    }
-//                }
-//                free(seqs);
-//
-//                int32_t nseqs;
-//                const char** seqs1 = bcf_hdr_seqnames(vodr->hdr, &nseqs);
-//                for (uint32_t i=0; i<nseqs; ++i)
-//                {
-//                    if (kh_get(sdict, h, seqs1[i])==kh_end(h))
-//                    {
-//                        char* seq = strdup(seqs1[i]);
-//                        k = kh_put(sdict, h, seq, &success);
-//                        if (!success)
-//                        {
-//                            intervals.push_back(GenomeInterval(std::string(seq)));
-//                        }
-//                        else
-//                        {
-//                            free(seq);
-//                        }
-//                    }
-//                }
-//                free(seqs1);
-//
-//                //clean up
-//                if (s.m) free(s.s);
-//                for (k = kh_begin(h); k != kh_end(h); ++k)
-//                {
-//                    if (kh_exist(h, k))
-//                    {
-//                        free((char*)kh_key(h, k));
-//                    }
-//                }
-//                kh_clear(sdict, h);
-//            }
-//
-//            VCFGenotypingPool pool;
-//
-//            //iterate through chromosomes
-//            for (uint32_t i=0; i<intervals.size(); ++i)
-//            {
-//                vodr->jump_to_interval(intervals[i]);
-//                sodr->jump_to_interval(intervals[i]);
-//
-//                bcf1_t *v = vodw->get_bcf1_from_pool();
-//                while (vodr->read(v))
-//                {
-//                    int32_t count = 0;
-//                    while(sodr->read(s))
-//                    {
-//                        //update VCF records that overlap with read
-//                        pool.process_read(s);
-//                        ++count;
-//                    }
-//
-//                    //remove records that occur before this read
-//                    pool.flush();
-//                }
-//            }
-//
-//            vodw->close();
+            sodrs[i]->close();
+            bam_destroy1(s[i]);
+        }
+
+        for (uint32_t i=0; i<window.size(); ++i)
+        {
+            delete window[i];
+        }
+        for (uint32_t i=0; i<window_reads.size(); ++i)
+        {
+            bam_destroy1(window_reads[i]);
+            delete decoded_reads[i];
         }
     }
 
     private:
 
+    /**
+     * Genotypes the candidate sites left in vodr, nearby sites are grouped into
+     * windows and the reads of a window are fetched once for all its sites.
+     */
+    void genotype_by_windows()
+    {
+        uint32_t no_sites = 0;
+        int32_t rid = -1;
+        int32_t beg1 = 0;
+        int32_t end1 = 0;
+
+        v = vodw->get_bcf1_from_pool();
+        while (vodr->read(v))
+        {
+            if (is_written(v))
+            {
+                continue;
+            }
+
+            if (no_sites==window.size())
+            {
+                window.push_back(new LHMMGenotypingRecord(vodr->hdr, v, bcf_hdr_nsamples(vodw->hdr), probe_cache));
+                window.back()->set_prefilter(kmer_size, kmer_min_qual, debug);
+                window.back()->set_quantized(quantized, debug);
+            }
+            else
+            {
+                window[no_sites]->set(vodr->hdr, v);
+            }
+            LHMMGenotypingRecord* g = window[no_sites];
+
+            //close the window if the site is far from it
+            if (no_sites &&
+                (g->rid!=rid ||
+                 g->pos1>end1+(int32_t)window_gap ||
+                 g->end1-beg1+1>GENOTYPE_MAX_WINDOW_LENGTH))
+            {
+                int32_t last_rid = window[no_sites-1]->rid;
+                int32_t last_pos1 = window[no_sites-1]->pos1;
+                genotype_window(no_sites, beg1, end1);
+
+                //every site before the current one has been written out
+                if (checkpoint_interval &&
+                    no_reads_since_checkpoint>=checkpoint_interval &&
+                    (g->rid!=last_rid || g->pos1>last_pos1))
+                {
+                    save_checkpoint(g->rid, g->pos1);
+                }
+
+                //the window records are reused, keep the current site
+                std::swap(window[0], window[no_sites]);
+                no_sites = 0;
+            }
+
+            if (!no_sites)
+            {
+                rid = g->rid;
+                beg1 = g->pos1;
+                end1 = g->end1;
+            }
+            else if (g->end1>end1)
+            {
+                end1 = g->end1;
+            }
+
+            ++no_sites;
+            v = vodw->get_bcf1_from_pool();
+        }
+        vodw->store_bcf1_into_pool(v);
+
+        if (no_sites)
+        {
+            genotype_window(no_sites, beg1, end1);
+        }
+    }
+
+    /**
+     * Fetches the reads of the window from beg1 to end1 and genotypes its first
+     * no_sites sites in order, each read is decoded once for all the sites it overlaps.
+     */
+    void genotype_window(uint32_t no_sites, int32_t beg1, int32_t end1)
+    {
+        std::string chrom(bcf_get_chrom(vodr->hdr, window[0]->v));
+        GenomeInterval interval(chrom, beg1, end1);
+        ++no_windows;
+
+        //reads of each BAM file are kept apart to be genotyped in the same order as a query per site
+        std::vector<uint32_t> first_read(sodrs.size()+1, 0);
+        uint32_t no_reads = 0;
+        for (uint32_t i=0; i<sodrs.size(); ++i)
+        {
+            first_read[i] = no_reads;
+            if (sodrs[i]->jump_to_interval(interval))
+            {
+                while (sodrs[i]->read(s[i]))
+                {
+                    if (!GenotypingRead::is_genotypable(s[i]))
+                    {
+                        continue;
+                    }
+
+                    if (no_reads==window_reads.size())
+                    {
+                        window_reads.push_back(bam_init1());
+                        decoded_reads.push_back(new GenotypingRead());
+                    }
+                    bam_copy1(window_reads[no_reads], s[i]);
+
+                    //marks the read as not decoded
+                    decoded_reads[no_reads]->tid = -1;
+                    ++no_reads;
+                    ++no_reads_since_checkpoint;
+                }
+            }
+        }
+        first_read[sodrs.size()] = no_reads;
+
+        //reads of each BAM file before this one end before the current site
+        std::vector<uint32_t> lo(first_read.begin(), first_read.end()-1);
+        for (uint32_t j=0; j<no_sites; ++j)
+        {
+            LHMMGenotypingRecord* g = window[j];
+
+            for (uint32_t i=0; i<sodrs.size(); ++i)
+            {
+                while (lo[i]<first_read[i+1] && bam_get_end_pos1(window_reads[lo[i]])<g->pos1)
+                {
+                    ++lo[i];
+                }
+
+                for (uint32_t k=lo[i]; k<first_read[i+1]; ++k)
+                {
+                    bam1_t* b = window_reads[k];
+                    if (bam_get_pos1(b)>g->end1)
+                    {
+                        break;
+                    }
+
+                    if (bam_get_end_pos1(b)<g->pos1)
+                    {
+                        continue;
+                    }
+
+                    //decoded on first use
+                    GenotypingRead* read = decoded_reads[k];
+                    if (read->tid==-1)
+                    {
+                        read->set(b, sample_indices[i]);
+                    }
+                    g->genotype(read);
+                }
+            }
+
+            if (g->vtype==VT_INDEL)
+            {
+                g->compute(&lhmm);
+            }
+
+            no_alignments += g->no_alignments;
+            no_cached_alignments += g->no_cached_alignments;
+            no_stitched += g->no_stitched;
+            no_prefiltered += g->no_prefiltered;
+            no_prefilter_discordances += g->no_prefilter_discordances;
+            no_quantized_alignments += g->no_quantized_alignments;
+            no_quantization_violations += g->no_quantization_violations;
+            max_quantization_error = std::max(max_quantization_error, g->max_quantization_error);
+
+            if (g->read_no)
+            {
+                if (g->vtype==VT_SNP) ++no_snps_genotyped;
+                if (g->vtype==VT_INDEL) ++no_indels_genotyped;
+            }
+
+            g->print(vodw);
+            g->clear();
+        }
+    }
+
+    /**
+     * Returns true if the candidate sites at the start of the interval vodr jumped
+     * to are so dense that windows would fetch most of the reads anyway, then the
+     * reads are better streamed past the sites.  Moves vodr past these sites.
+     */
+    bool is_dense()
+    {
+        uint32_t no_sites = 0;
+        int32_t rid = -1;
+        int32_t beg1 = 0;
+        int32_t end1 = 0;
+        int32_t span_beg1 = 0;
+        int64_t windowed = 0;
+
+        bcf1_t *rec = bcf_init1();
+        while (no_sites<GENOTYPE_DENSITY_SAMPLE_SIZE && vodr->read(rec))
+        {
+            bcf_unpack(rec, BCF_UN_STR);
+            int32_t pos1 = bcf_get_pos1(rec);
+            int32_t epos1 = bcf_get_end_pos1(rec);
+
+            if (no_sites && bcf_get_rid(rec)!=rid)
+            {
+                break;
+            }
+
+            if (!no_sites)
+            {
+                rid = bcf_get_rid(rec);
+                span_beg1 = beg1 = pos1;
+                end1 = epos1;
+            }
+            else if (pos1>end1+(int32_t)window_gap || epos1-beg1+1>GENOTYPE_MAX_WINDOW_LENGTH)
+            {
+                windowed += end1-beg1+1;
+                beg1 = pos1;
+                end1 = epos1;
+            }
+            else if (epos1>end1)
+            {
+                end1 = epos1;
+            }
+
+            ++no_sites;
+        }
+        bcf_destroy1(rec);
+
+        windowed += end1-beg1+1;
+        return no_sites>1 && 2*windowed>(int64_t)end1-span_beg1+1;
+    }
+
+    /**
+     * Returns true if v was written out by the run being resumed.  Without an
+     * index, the candidate sites are read again from the start of the file.
+     */
+    bool is_written(bcf1_t *v)
+    {
+        if (resume_rid==-1)
+        {
+            return false;
+        }
+
+        if (bcf_get_rid(v)==resume_rid && bcf_get_pos1(v)>=resume_pos1)
+        {
+            //read in one pass, the remaining sites all follow
+            if (!vodr->index_loaded)
+            {
+                resume_rid = -1;
+            }
+            return false;
+        }
+
+        return bcf_get_rid(v)==resume_rid || !vodr->index_loaded;
+    }
+
+    /**
+     * Saves a checkpoint, every candidate site before pos1 on rid has been
+     * written out and none at or after it.
+     */
+    void save_checkpoint(int32_t rid, int32_t pos1)
+    {
+        checkpoint->chrom = bcf_hdr_id2name(vodr->hdr, rid);
+        checkpoint->flushed_pos1 = pos1;
+        checkpoint->next_pos1 = pos1;
+        if ((checkpoint->offset = vodw->checkpoint())<0)
+        {
+            fprintf(stderr, "[E:%s:%d %s] cannot flush %s for checkpoint\n", __FILE__, __LINE__, __FUNCTION__, output_vcf_file.c_str());
+            exit(1);
+        }
+
+        //records printed out by the sweep are counted by the buffer
+        checkpoint->set_counter("no_snps_genotyped", no_snps_genotyped + (buffer ? buffer->no_snps_genotyped : 0));
+        checkpoint->set_counter("no_indels_genotyped", no_indels_genotyped + (buffer ? buffer->no_indels_genotyped : 0));
+        checkpoint->set_counter("no_alignments", no_alignments + (buffer ? buffer->no_alignments : 0));
+        checkpoint->set_counter("no_cached_alignments", no_cached_alignments + (buffer ? buffer->no_cached_alignments : 0));
+        checkpoint->set_counter("no_stitched", no_stitched + (buffer ? buffer->no_stitched : 0));
+        checkpoint->set_counter("no_prefiltered", no_prefiltered + (buffer ? buffer->no_prefiltered : 0));
+        checkpoint->set_counter("no_prefilter_discordances", no_prefilter_discordances + (buffer ? buffer->no_prefilter_discordances : 0));
+        checkpoint->set_counter("no_quantized_alignments", no_quantized_alignments + (buffer ? buffer->no_quantized_alignments : 0));
+        checkpoint->set_counter("no_quantization_violations", no_quantization_violations + (buffer ? buffer->no_quantization_violations : 0));
+        checkpoint->write();
+        no_reads_since_checkpoint = 0;
+    }
+
     void swap(double& a, double& b)
     {
         b = (a=a+b) - b;
@@ -25,6 +25,8 @@
 #define GENOTYPE_H
 
 #include <string>
+#include <queue>
+#include <functional>
 #include "htslib/kseq.h"
 #include "utils.h"
 #include "program.h"
@@ -32,6 +34,7 @@
 #include "bam_ordered_reader.h"
 #include "bcf_ordered_reader.h"
 #include "bcf_ordered_writer.h"
+#include "checkpoint.h"
 #include "variant_manip.h"
 #include "genotyping_buffer.h"
 
@@ -22,3 +22,469 @@
 */
 
 #include "genotyping_buffer.h"
+
+/**
+ * Constructor.
+ *
+ * @no_threads - number of worker threads, 0 to genotype on the calling thread
+ */
+GenotypingBuffer::GenotypingBuffer(BCFOrderedReader *odr, BCFOrderedWriter *odw, uint32_t no_threads)
+{
+    this->odr = odr;
+    this->odw = odw;
+    no_samples = bcf_hdr_nsamples(odw->hdr);
+
+    no_snps_genotyped = 0;
+    no_indels_genotyped = 0;
+    no_alignments = 0;
+    no_cached_alignments = 0;
+    no_stitched = 0;
+    no_prefiltered = 0;
+    no_prefilter_discordances = 0;
+    no_quantized_alignments = 0;
+    no_quantization_violations = 0;
+    max_quantization_error = 0;
+
+    kmer_size = 0;
+    kmer_min_qual = 0;
+    audit_prefilter = false;
+    quantized = false;
+    audit_quantized = false;
+    probe_cache = NULL;
+
+    retired_pos1 = 0;
+    printed_rid = -1;
+    printed_pos1 = 0;
+    resume_rid = -1;
+    resume_pos1 = 0;
+
+    this->no_threads = no_threads;
+    max_retired = 256*no_threads;
+    stop = false;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&work_available, NULL);
+    pthread_cond_init(&work_done, NULL);
+
+    workers.resize(no_threads);
+    for (uint32_t i=0; i<no_threads; ++i)
+    {
+        if (pthread_create(&workers[i], NULL, work_on, this))
+        {
+            fprintf(stderr, "[E:%s:%d %s] cannot create worker thread\n", __FILE__, __LINE__, __FUNCTION__);
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Destructor.
+ */
+GenotypingBuffer::~GenotypingBuffer()
+{
+    pthread_mutex_lock(&mutex);
+    stop = true;
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&mutex);
+
+    for (uint32_t i=0; i<workers.size(); ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&work_available);
+    pthread_cond_destroy(&work_done);
+
+    for (uint32_t j=0; j<buffer.size(); ++j)
+    {
+        delete buffer[j];
+    }
+    std::list<GenotypingRecord*>::iterator i;
+    for (i=pool.begin(); i!=pool.end(); ++i)
+    {
+        delete *i;
+    }
+    for (uint32_t j=0; j<read_pool.size(); ++j)
+    {
+        delete read_pool[j];
+    }
+}
+
+/**
+ * Genotypes a read of a sample against all buffered records it overlaps, the reads
+ * are expected to be sorted and on the chromosome of the candidate records.
+ */
+void GenotypingBuffer::process_read(bam1_t *s, int32_t sample_id)
+{
+    if (!GenotypingRead::is_genotypable(s))
+    {
+        return;
+    }
+
+    int32_t spos1 = bam_get_pos1(s);
+    int32_t epos1 = bam_get_end_pos1(s);
+
+    retire(spos1);
+    add_rec(epos1);
+
+    GenotypingRead* read = NULL;
+
+    //active records all end at or after spos1
+    for (uint32_t i=0; i<active.size(); ++i)
+    {
+        GenotypingRecord* g = active[i].second;
+
+        if (g->pos1<=epos1)
+        {
+            if (!read)
+            {
+                if (read_pool.size()!=0)
+                {
+                    read = read_pool.back();
+                    read_pool.pop_back();
+                }
+                else
+                {
+                    read = new GenotypingRead();
+                }
+                read->set(s, sample_id);
+                read->refs = 0;
+            }
+
+            g->genotype(read);
+        }
+    }
+
+    if (read)
+    {
+        release(read);
+    }
+}
+
+/**
+ * Prints out all the records, including those not yet read in.
+ */
+void GenotypingBuffer::flush()
+{
+    for (uint32_t i=0; i<active.size(); ++i)
+    {
+        retire(active[i].second);
+    }
+    active.clear();
+    retired_pos1 = INT32_MAX;
+    print_retired(true);
+
+    //records with no overlapping reads are printed as they are read
+    bcf1_t *v = odw->get_bcf1_from_pool();
+    while (read_rec(v))
+    {
+        GenotypingRecord *g = get_record(v);
+
+        print(g);
+        v = odw->get_bcf1_from_pool();
+    }
+    odw->store_bcf1_into_pool(v);
+}
+
+/**
+ * Adds pileup records till the first record after epos1.
+ */
+bool GenotypingBuffer::add_rec(int32_t epos1)
+{
+    //add records only if the new record overlaps with read
+    if (buffer.size()!=0)
+    {
+        if (buffer.back()->pos1>epos1)
+        {
+            return false;
+        }
+    }
+
+    bool added_record = false;
+    bcf1_t *v = odw->get_bcf1_from_pool();
+    while (read_rec(v))
+    {
+        GenotypingRecord *g = get_record(v);
+
+        buffer.push_back(g);
+        active.push_back(std::make_pair(g->end1, g));
+        std::push_heap(active.begin(), active.end(), std::greater<std::pair<int32_t, GenotypingRecord*> >());
+        added_record = true;
+
+        if (g->pos1>epos1)
+        {
+            return added_record;
+        }
+
+        v = odw->get_bcf1_from_pool();
+    }
+    odw->store_bcf1_into_pool(v);
+
+    return added_record;
+}
+
+/**
+ * Retires the records that end before pos1 and prints out the genotyped
+ * records at the front of the buffer.
+ */
+void GenotypingBuffer::retire(int32_t pos1)
+{
+    retired_pos1 = pos1;
+    while (active.size()!=0 && active.front().first<pos1)
+    {
+        GenotypingRecord* g = active.front().second;
+        std::pop_heap(active.begin(), active.end(), std::greater<std::pair<int32_t, GenotypingRecord*> >());
+        active.pop_back();
+        retire(g);
+    }
+
+    if (buffer.size()!=0 && buffer.front()->end1<pos1)
+    {
+        print_retired(false);
+    }
+}
+
+/**
+ * Genotypes a record whose reads are all in, it is printed out when it
+ * and all the records read in before it are genotyped.
+ */
+void GenotypingBuffer::retire(GenotypingRecord* g)
+{
+    LHMMGenotypingRecord* lg = (LHMMGenotypingRecord*) g;
+
+    //nothing to align, or no one to hand the alignment to
+    if (!no_threads || lg->vtype!=VT_INDEL || !lg->read_no)
+    {
+        if (lg->vtype==VT_INDEL)
+        {
+            lg->compute(&lhmm);
+        }
+
+        lg->genotyped = true;
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    work.push_back(g);
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Prints out genotyped records at the front of the buffer, if wait
+ * is true, waits for all the retired records to be genotyped.
+ */
+void GenotypingBuffer::print_retired(bool wait)
+{
+    pthread_mutex_lock(&mutex);
+    while (!buffer.empty())
+    {
+        LHMMGenotypingRecord* g = (LHMMGenotypingRecord*) buffer.front();
+        if (!g->genotyped)
+        {
+            //keep the retired records waiting to be printed bounded,
+            //there is no point in waiting for a record still taking reads
+            if (g->end1<retired_pos1 && (wait || buffer.size()-active.size()>max_retired))
+            {
+                pthread_cond_wait(&work_done, &mutex);
+                continue;
+            }
+
+            break;
+        }
+
+        buffer.pop_front();
+        pthread_mutex_unlock(&mutex);
+        print(g);
+        pthread_mutex_lock(&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Genotypes retired records till the buffer is destroyed.
+ */
+void* GenotypingBuffer::work_on(void* arg)
+{
+    GenotypingBuffer* b = (GenotypingBuffer*) arg;
+    LHMM lhmm;
+
+    pthread_mutex_lock(&b->mutex);
+    while (true)
+    {
+        if (b->work.empty())
+        {
+            if (b->stop)
+            {
+                break;
+            }
+
+            pthread_cond_wait(&b->work_available, &b->mutex);
+            continue;
+        }
+
+        LHMMGenotypingRecord* g = (LHMMGenotypingRecord*) b->work.front();
+        b->work.pop_front();
+        pthread_mutex_unlock(&b->mutex);
+
+        g->compute(&lhmm);
+
+        pthread_mutex_lock(&b->mutex);
+        g->genotyped = true;
+        pthread_cond_signal(&b->work_done);
+    }
+    pthread_mutex_unlock(&b->mutex);
+
+    return NULL;
+}
+
+/**
+ * Skips the records on rid that start before pos1 as they have been
+ * printed out by the run being resumed.
+ */
+void GenotypingBuffer::set_resume_pos1(int32_t rid, int32_t pos1)
+{
+    resume_rid = rid;
+    resume_pos1 = pos1;
+}
+
+/**
+ * Gets the position of the first record not printed out, every record read
+ * in before it has been printed out and none at its position.  Returns false
+ * if there is no such record in the buffer.
+ */
+bool GenotypingBuffer::get_unprinted_pos1(int32_t& rid, int32_t& pos1)
+{
+    if (buffer.empty())
+    {
+        return false;
+    }
+
+    GenotypingRecord* g = buffer.front();
+    if (g->rid==printed_rid && g->pos1<=printed_pos1)
+    {
+        return false;
+    }
+
+    rid = g->rid;
+    pos1 = g->pos1;
+    return true;
+}
+
+/**
+ * Reads in the next candidate record that was not printed out by a resumed run.
+ */
+bool GenotypingBuffer::read_rec(bcf1_t *v)
+{
+    while (odr->read(v))
+    {
+        if (bcf_get_rid(v)!=resume_rid || bcf_get_pos1(v)>=resume_pos1)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Sets the k-mer prefilter of the indel records, see LHMMGenotypingRecord::set_prefilter.
+ */
+void GenotypingBuffer::set_prefilter(uint32_t k, uint32_t min_qual, bool audit)
+{
+    kmer_size = k;
+    kmer_min_qual = min_qual;
+    audit_prefilter = audit;
+}
+
+/**
+ * Sets the alignment with quantized scores of the indel records, see LHMMGenotypingRecord::set_quantized.
+ */
+void GenotypingBuffer::set_quantized(bool quantized, bool audit)
+{
+    this->quantized = quantized;
+    audit_quantized = audit;
+}
+
+/**
+ * Sets the probe cache of the indel records.
+ */
+void GenotypingBuffer::set_probe_cache(ProbeCache *probe_cache)
+{
+    this->probe_cache = probe_cache;
+}
+
+/**
+ * Gets a record for v from the pool, creates a new record if necessary.
+ */
+GenotypingRecord* GenotypingBuffer::get_record(bcf1_t *v)
+{
+    GenotypingRecord *g = NULL;
+    if (pool.size()!=0)
+    {
+        g = pool.front();
+        pool.pop_front();
+        g->set(odr->hdr, v);
+    }
+    else
+    {
+        LHMMGenotypingRecord *lg = new LHMMGenotypingRecord(odr->hdr, v, no_samples, probe_cache);
+        lg->set_prefilter(kmer_size, kmer_min_qual, audit_prefilter);
+        lg->set_quantized(quantized, audit_quantized);
+        g = lg;
+    }
+
+    return g;
+}
+
+/**
+ * Returns a read to the read pool if no record holds on to it.
+ */
+void GenotypingBuffer::release(GenotypingRead* read)
+{
+    if (!read->refs)
+    {
+        read_pool.push_back(read);
+    }
+}
+
+/**
+ * Prints out a record and returns it to the pool.
+ */
+void GenotypingBuffer::print(GenotypingRecord* g)
+{
+    LHMMGenotypingRecord* lg = (LHMMGenotypingRecord*) g;
+    for (uint32_t i=0; i<lg->collected.size(); ++i)
+    {
+        --lg->collected[i]->refs;
+        release(lg->collected[i]);
+    }
+
+    no_alignments += lg->no_alignments;
+    no_cached_alignments += lg->no_cached_alignments;
+    no_stitched += lg->no_stitched;
+    no_prefiltered += lg->no_prefiltered;
+    no_prefilter_discordances += lg->no_prefilter_discordances;
+    no_quantized_alignments += lg->no_quantized_alignments;
+    no_quantization_violations += lg->no_quantization_violations;
+    max_quantization_error = std::max(max_quantization_error, lg->max_quantization_error);
+
+    if (lg->read_no)
+    {
+        if (lg->vtype==VT_SNP)
+        {
+            ++no_snps_genotyped;
+        }
+        else if (lg->vtype==VT_INDEL)
+        {
+            ++no_indels_genotyped;
+        }
+    }
+
+    printed_rid = g->rid;
+    printed_pos1 = g->pos1;
+
+    g->print(odw);
+    g->clear();
+    pool.push_front(g);
+}
@@ -25,104 +25,201 @@
 #define GENOTYPING_BUFFER_H
    
 #include <string>
+#include <list>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <pthread.h>
 #include "bam_ordered_reader.h"
 #include "bcf_ordered_reader.h"
 #include "bcf_ordered_writer.h"
-#include "genotyping_record.h"
+#include "lhmm.h"
+#include "lhmm_genotyping_record.h"
 
 /**
  * Maintains read information and allows for additional reads
  * till VCF record can be printed out.
  *
- * This class is to be inherited and 
+ * The reads of a sorted BAM file are swept over the candidate
+ * records of a sorted VCF file in one pass.  For each read, the
+ * records that end before the read are retired, the records that
+ * start before the end of the read are read in and the read is
+ * genotyped against every active record it overlaps.  Each read
+ * is decoded once into a GenotypingRead that is shared by the records.
+ *
+ * Records still taking reads are kept in a min-heap on their end
+ * position, so records are retired as soon as the reads move past
+ * their end, even when a long record before them is still taking
+ * reads, and a read is only checked against the active records.  With
+ * worker threads, the indel alignments of retired records are done
+ * by the workers, each with its own LHMM, while the sweep goes on.
+ * All records wait in a ring sorted by position and are printed in
+ * the order they were read in as soon as they are genotyped.
  */
 class GenotypingBuffer
 {
     public:
     BCFOrderedReader *odr;
     BCFOrderedWriter *odw;
-    std::list<GenotypingRecord*> buffer; //waiting for more reads
+    std::deque<GenotypingRecord*> buffer; //records read in and not printed, in order of reading in
+    std::vector<std::pair<int32_t, GenotypingRecord*> > active; //min-heap on end1 of the records still taking reads
+    int32_t retired_pos1; //records ending before this position are retired
+    int32_t printed_rid;  //position of the last record printed out
+    int32_t printed_pos1;
+    int32_t resume_rid;   //records on resume_rid before resume_pos1 were printed out by a resumed run
+    int32_t resume_pos1;
     std::list<GenotypingRecord*> pool; //unused records
+    std::vector<GenotypingRead*> read_pool; //unused decoded reads
+
+    //samples in the output header
+    uint32_t no_samples;
+
+    //used for aligning reads to probes when there are no worker threads
+    LHMM lhmm;
+
+    ///////////
+    //workers//
+    ///////////
+    uint32_t no_threads;
+    std::vector<pthread_t> workers;
+    std::deque<GenotypingRecord*> work; //retired records waiting for a worker
+    uint32_t max_retired;
+    bool stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+
+    /////////
+    //stats//
+    /////////
+    uint32_t no_snps_genotyped;
+    uint32_t no_indels_genotyped;
+    uint32_t no_alignments;
+    uint32_t no_cached_alignments;
+    uint32_t no_stitched;
+    uint32_t no_prefiltered;
+    uint32_t no_prefilter_discordances;
+
+    uint32_t no_quantized_alignments;
+    uint32_t no_quantization_violations;
+    double max_quantization_error;
+
+    //k-mer prefilter of the indel records
+    uint32_t kmer_size;
+    uint32_t kmer_min_qual;
+    bool audit_prefilter;
+
+    //alignment of the reads of the indel records with quantized scores
+    bool quantized;
+    bool audit_quantized;
+
+    //generates the probes of indels without REFPROBE and ALTPROBE, may be NULL
+    ProbeCache *probe_cache;
+
+    /**
+     * Constructor.
+     *
+     * @no_threads - number of worker threads, 0 to genotype on the calling thread
+     */
+    GenotypingBuffer(BCFOrderedReader *odr, BCFOrderedWriter *odw, uint32_t no_threads=0);
 
-    uint32_t bref, vref;
-    uint32_t bstart, bend, vpos;
+    /**
+     * Destructor.
+     */
+    ~GenotypingBuffer();
 
     /**
-     * Print out all the records.
+     * Sets the k-mer prefilter of the indel records, see LHMMGenotypingRecord::set_prefilter.
+     * Must be called before any read is processed.
      */
-    GenotypingBuffer(){}
+    void set_prefilter(uint32_t k, uint32_t min_qual, bool audit);
 
     /**
-     * Print out all the records.
+     * Sets the alignment with quantized scores of the indel records, see
+     * LHMMGenotypingRecord::set_quantized.  Must be called before any read is processed.
      */
-    void flush()
-    {
-        std::list<GenotypingRecord*>::iterator i = buffer.begin();
-        while (i!=buffer.end())
-        {
-            GenotypingRecord* vx = *i;
+    void set_quantized(bool quantized, bool audit);
 
-            vx->print(odw);
+    /**
+     * Sets the probe cache of the indel records, the cache is only used on
+     * the calling thread.  Must be called before any read is processed.
+     */
+    void set_probe_cache(ProbeCache *probe_cache);
 
-            vx->clear();
-            pool.push_front(vx);
-            i = buffer.erase(i);
-        }
-    }
+    /**
+     * Skips the records on rid that start before pos1 as they have been
+     * printed out by the run being resumed.
+     */
+    void set_resume_pos1(int32_t rid, int32_t pos1);
+
+    /**
+     * Gets the position of the first record not printed out, every record read
+     * in before it has been printed out and none at its position.  Returns false
+     * if there is no such record in the buffer.
+     */
+    bool get_unprinted_pos1(int32_t& rid, int32_t& pos1);
+
+    /**
+     * Genotypes a read of a sample against all buffered records it overlaps, the reads
+     * are expected to be sorted and on the chromosome of the candidate records.
+     */
+    void process_read(bam1_t *s, int32_t sample_id=0);
+
+    /**
+     * Prints out all the records, including those not yet read in.
+     */
+    void flush();
 
     /**
      * Adds pileup records till the first record after epos1.
      */
-    bool add_rec(int32_t epos1)
-    {
-        //add records only if the new record overlaps with read
-        if (buffer.size()!=0)
-        {
-            bcf1_t *v = buffer.back()->v;
-            int32_t vpos1 = bcf_get_pos1(v);
-
-            if (vpos1>epos1)
-            {
-                return false;
-            }
-        }
-
-        bool added_record = false;
-        bcf1_t *v = odw->get_bcf1_from_pool();
-        while (odr->read(v))
-        {
-            GenotypingRecord *p = NULL;
-            if (pool.size()!=0)
-            {
-                p = pool.front();
-                pool.pop_front();
-            }
-            else
-            {
-                p = new GenotypingRecord(odr->hdr, v);
-            }
-
-            p->clear();
-
-            buffer.push_back(p);
-            added_record = true;
-
-            if ((bcf_get_pos1(p->v))>epos1)
-                break;
-        }
-
-        return added_record;
-    }
-
-    int32_t read_is_before_first_vcf_record(bam1_t *s)
-    {
-        bcf1_t *v = (*(buffer.begin()))->v;
-        int32_t vpos1 = bcf_get_pos1(v);
-        int32_t epos1 = bam_get_end_pos1(s);
-
-        return (epos1+100000)<vpos1 ? vpos1 : 0;
-    }
-};
+    bool add_rec(int32_t epos1);
+
+    /**
+     * Retires the records that end before pos1 and prints out the genotyped
+     * records at the front of the buffer.
+     */
+    void retire(int32_t pos1);
 
+    private:
+
+    /**
+     * Genotypes a record whose reads are all in and prints it out when it
+     * and all the records retired before it are genotyped.
+     */
+    void retire(GenotypingRecord* g);
+
+    /**
+     * Prints out genotyped records at the front of the buffer, if wait
+     * is true, waits for all the retired records to be genotyped.
+     */
+    void print_retired(bool wait);
+
+    /**
+     * Reads in the next candidate record that was not printed out by a resumed run.
+     */
+    bool read_rec(bcf1_t *v);
+
+    /**
+     * Gets a record for v from the pool, creates a new record if necessary.
+     */
+    GenotypingRecord* get_record(bcf1_t *v);
+
+    /**
+     * Returns a read to the read pool if no record holds on to it.
+     */
+    void release(GenotypingRead* read);
+
+    /**
+     * Prints out a record and returns it to the pool.
+     */
+    void print(GenotypingRecord* g);
+
+    /**
+     * Genotypes retired records till the buffer is destroyed.
+     */
+    static void* work_on(void* arg);
+};
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,268 @@
+/* The MIT License
+
+   Copyright (c) 2014 Adrian Tan <atks@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "genotyping_read.h"
+
+namespace
+{
+
+/**
+ * FNV-1a hash of the name of a read and its sample, read names are only unique within a sample.
+ */
+uint64_t hash_name(const char* name, int32_t sample_id)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char* p=name; *p; ++p)
+    {
+        h = (h ^ (uint8_t) *p) * 1099511628211ULL;
+    }
+    h = (h ^ (uint32_t) sample_id) * 1099511628211ULL;
+
+    return h;
+}
+
+}
+
+/**
+ * Constructor.
+ */
+GenotypingRead::GenotypingRead()
+{
+    sample_id = 0;
+    name = {0,0,0};
+    tid = -1;
+    pos1 = 0;
+    end1 = 0;
+    flag = 0;
+    mapq = 0;
+    mtid = -1;
+    mpos1 = 0;
+    name_hash = 0;
+    seq = {0,0,0};
+    qual = {0,0,0};
+    refs = 0;
+};
+
+/**
+ * Destructor.
+ */
+GenotypingRead::~GenotypingRead()
+{
+    if (name.m) free(name.s);
+    if (seq.m) free(seq.s);
+    if (qual.m) free(qual.s);
+};
+
+/**
+ * Decodes s.
+ */
+void GenotypingRead::set(bam1_t *s, int32_t sample_id)
+{
+    this->sample_id = sample_id;
+
+    name.l = 0;
+    kputs(bam_get_qname(s), &name);
+    name_hash = hash_name(name.s, sample_id);
+    tid = bam_get_tid(s);
+    pos1 = bam_get_pos1(s);
+    end1 = bam_get_end_pos1(s);
+    flag = bam_get_flag(s);
+    mapq = bam_get_mapq(s);
+    mtid = bam_get_mtid(s);
+    mpos1 = bam_get_mpos1(s);
+
+    bam_get_seq_string(s, &seq);
+    bam_get_qual_string(s, &qual);
+    qclasses.resize(qual.l);
+    for (uint32_t i=0; i<qual.l; ++i)
+    {
+        qclasses[i] = LHMM::quality_class(qual.s[i]);
+    }
+
+    blocks.clear();
+    uint32_t *cigar = bam_get_cigar(s);
+    int32_t cpos = 0; //offset from pos1
+    int32_t qpos = 0;
+    for (uint32_t i=0; i<bam_get_n_cigar_op(s); ++i)
+    {
+        int32_t op = bam_cigar_op(cigar[i]);
+        int32_t len = bam_cigar_oplen(cigar[i]);
+        int32_t type = bam_cigar_type(op);
+
+        //consumes query and reference
+        if (type==3 && len)
+        {
+            if (blocks.size() && blocks.back().pos1+blocks.back().len==pos1+cpos &&
+                blocks.back().rpos+blocks.back().len==qpos)
+            {
+                blocks.back().len += len;
+            }
+            else
+            {
+                aligned_block_t block = {pos1+cpos, qpos, len};
+                blocks.push_back(block);
+            }
+        }
+
+        if (type&2) cpos += len;
+        if (type&1) qpos += len;
+    }
+};
+
+/**
+ * Sets this read to the consensus of two overlapping mates.
+ */
+bool GenotypingRead::stitch(GenotypingRead *first, GenotypingRead *second)
+{
+    //offset of the read index of second in first, from the bases aligned in the overlap
+    int32_t d = -1;
+    int32_t oend1 = first->end1<second->end1 ? first->end1 : second->end1;
+    for (int32_t p=second->pos1; p<=oend1; ++p)
+    {
+        int32_t i = first->get_rpos(p);
+        int32_t j = second->get_rpos(p);
+        if (i==BAM_READ_INDEX_NA || j==BAM_READ_INDEX_NA)
+        {
+            continue;
+        }
+
+        if (d==-1)
+        {
+            d = i-j;
+            if (d<0)
+            {
+                return false;
+            }
+        }
+        else if (d!=i-j)
+        {
+            return false;
+        }
+    }
+
+    if (d==-1)
+    {
+        return false;
+    }
+
+    sample_id = first->sample_id;
+    name.l = 0;
+    kputsn(first->name.s, first->name.l, &name);
+    name_hash = first->name_hash;
+    tid = first->tid;
+    pos1 = first->pos1;
+    end1 = first->end1>second->end1 ? first->end1 : second->end1;
+    flag = first->flag;
+    mapq = first->mapq;
+    mtid = -1;
+    mpos1 = 0;
+    refs = 0;
+
+    int32_t len1 = first->seq.l;
+    int32_t len2 = second->seq.l;
+    int32_t len = len1>d+len2 ? len1 : d+len2;
+    seq.l = 0;
+    qual.l = 0;
+    qclasses.clear();
+    for (int32_t i=0; i<len; ++i)
+    {
+        int32_t j = i-d;
+        if (i<len1 && j>=0 && j<len2)
+        {
+            char b1 = first->seq.s[i];
+            char b2 = second->seq.s[j];
+            int32_t q1 = first->qual.s[i]-33;
+            int32_t q2 = second->qual.s[j]-33;
+            if (b1==b2)
+            {
+                //the sum may lie past what a quality character holds, its class is kept
+                int32_t q = q1+q2;
+                kputc(b1, &seq);
+                kputc((q<GENOTYPING_READ_MAX_PHRED ? q : GENOTYPING_READ_MAX_PHRED)+33, &qual);
+                qclasses.push_back(q<LHMM_NO_QUAL_CLASSES-1 ? q : LHMM_NO_QUAL_CLASSES-1);
+            }
+            else
+            {
+                kputc(q1==q2 ? 'N' : (q1>q2 ? b1 : b2), &seq);
+                kputc((q1>q2 ? q1-q2 : q2-q1)+33, &qual);
+                qclasses.push_back(LHMM::quality_class(qual.s[qual.l-1]));
+            }
+        }
+        else if (i<len1)
+        {
+            kputc(first->seq.s[i], &seq);
+            kputc(first->qual.s[i], &qual);
+            qclasses.push_back(first->qclasses[i]);
+        }
+        else
+        {
+            kputc(second->seq.s[j], &seq);
+            kputc(second->qual.s[j], &qual);
+            qclasses.push_back(second->qclasses[j]);
+        }
+    }
+
+    //aligned as the first mate, then as the second mate past the end of the first
+    blocks = first->blocks;
+    for (uint32_t i=0; i<second->blocks.size(); ++i)
+    {
+        aligned_block_t block = second->blocks[i];
+        if (block.pos1+block.len-1<=first->end1)
+        {
+            continue;
+        }
+
+        if (block.pos1<=first->end1)
+        {
+            int32_t clip = first->end1-block.pos1+1;
+            block.pos1 += clip;
+            block.rpos += clip;
+            block.len -= clip;
+        }
+        block.rpos += d;
+        blocks.push_back(block);
+    }
+
+    return true;
+};
+
+/**
+ * Returns true if s is a primary alignment that passes QC, is not
+ * a duplicate and has a mapping quality of at least 13.
+ */
+bool GenotypingRead::is_genotypable(bam1_t *s)
+{
+    //has secondary alignment or fail QC or is duplicate or is unmapped
+    if (bam_get_flag(s) & 0x0704)
+    {
+        return false;
+    }
+
+    //ignore poor quality mappings
+    if (bam_get_mapq(s)<13)
+    {
+        return false;
+    }
+
+    return true;
+};
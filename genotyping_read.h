@@ -0,0 +1,133 @@
+/* The MIT License
+
+   Copyright (c) 2014 Adrian Tan <atks@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef GENOTYPING_READ_H
+#define GENOTYPING_READ_H
+
+#include <vector>
+#include "htslib/sam.h"
+#include "htslib/kstring.h"
+#include "hts_utils.h"
+#include "lhmm.h"
+
+/**
+ * Highest phred quality that a SAM quality character can hold.
+ */
+#define GENOTYPING_READ_MAX_PHRED 93
+
+/**
+ * A run of read bases aligned to consecutive reference positions.
+ */
+typedef struct
+{
+    int32_t pos1; //reference position of the first base
+    int32_t rpos; //read index of the first base
+    int32_t len;
+} aligned_block_t;
+
+/**
+ * A read decoded once for genotyping and shared by all the
+ * genotyping records it overlaps.
+ *
+ * Holds the read sequence, the phred+33 qualities and their
+ * classes in the LHMM emission tables, the mate information and
+ * the blocks of aligned bases from a single walk of the CIGAR, so
+ * that the base at any reference position is found in a few steps.
+ */
+class GenotypingRead
+{
+    public:
+    int32_t sample_id;
+    kstring_t name;
+    int32_t tid;
+    int32_t pos1;
+    int32_t end1;
+    uint16_t flag;
+    uint8_t mapq;
+    int32_t mtid;
+    int32_t mpos1;
+
+    kstring_t seq;
+    kstring_t qual;
+    std::vector<uint8_t> qclasses;
+
+    //aligned blocks in reference order
+    std::vector<aligned_block_t> blocks;
+
+    //hash of the name and sample, see LHMMGenotypingRecord for mate detection
+    uint64_t name_hash;
+
+    //number of genotyping records holding on to this read
+    uint32_t refs;
+
+    /**
+     * Constructor.
+     */
+    GenotypingRead();
+
+    /**
+     * Destructor.
+     */
+    ~GenotypingRead();
+
+    /**
+     * Decodes s.
+     */
+    void set(bam1_t *s, int32_t sample_id);
+
+    /**
+     * Sets this read to the consensus of two overlapping mates, second
+     * being the mate that starts at or after first.  Agreeing bases have
+     * their qualities added, the quality string is capped at
+     * GENOTYPING_READ_MAX_PHRED and the quality class at the highest LHMM
+     * quality class, disagreeing bases keep the better base with the difference of the
+     * qualities.  Returns false if the mates do not align to the reference
+     * with a consistent offset in their overlap.
+     */
+    bool stitch(GenotypingRead *first, GenotypingRead *second);
+
+    /**
+     * Returns the read index of the base aligned to the reference position pos1,
+     * BAM_READ_INDEX_NA if there is none.
+     */
+    inline int32_t get_rpos(int32_t pos1)
+    {
+        for (uint32_t i=0; i<blocks.size() && pos1>=blocks[i].pos1; ++i)
+        {
+            if (pos1<blocks[i].pos1+blocks[i].len)
+            {
+                return blocks[i].rpos + (pos1-blocks[i].pos1);
+            }
+        }
+
+        return BAM_READ_INDEX_NA;
+    }
+
+    /**
+     * Returns true if s is a primary alignment that passes QC, is not
+     * a duplicate and has a mapping quality of at least 13.
+     */
+    static bool is_genotypable(bam1_t *s);
+};
+
+#endif
@@ -22,3 +22,67 @@
 */
 
 #include "genotyping_record.h"
+
+/**
+ * Constructor.
+ */
+GenotypingRecord::GenotypingRecord()
+{
+    h = NULL;
+    v = NULL;
+    rid = -1;
+    pos1 = 0;
+    end1 = 0;
+}
+
+/**
+ * Constructor.
+ */
+GenotypingRecord::GenotypingRecord(bcf_hdr_t *h, bcf1_t *v)
+{
+    set(h, v);
+}
+
+/**
+ * Destructor.
+ */
+GenotypingRecord::~GenotypingRecord() {}
+
+/**
+ * Sets a bcf record.
+ */
+void GenotypingRecord::set(bcf_hdr_t *h, bcf1_t *v)
+{
+    this->h = h;
+    this->v = v;
+    bcf_unpack(v, BCF_UN_STR);
+    rid = bcf_get_rid(v);
+    pos1 = bcf_get_pos1(v);
+    end1 = bcf_get_end_pos1(v);
+}
+
+/**
+ * Genotypes a read and add to body of evidence.
+ */
+void GenotypingRecord::genotype(GenotypingRead *) {}
+
+/**
+ * Prints record, the record is handed over to odw.
+ */
+void GenotypingRecord::print(BCFOrderedWriter *odw)
+{
+    odw->write(v);
+    v = NULL;
+}
+
+/**
+ * Clears this record.
+ */
+void GenotypingRecord::clear()
+{
+    h = NULL;
+    v = NULL;
+    rid = -1;
+    pos1 = 0;
+    end1 = 0;
+}
@@ -25,6 +25,9 @@
 #define GENOTYPING_RECORD_H
 
 #include "htslib/vcf.h"
+#include "htslib/sam.h"
+#include "hts_utils.h"
+#include "genotyping_read.h"
 #include "bcf_ordered_writer.h"
 
 /**
@@ -38,12 +41,15 @@ class GenotypingRecord
     public:
     bcf_hdr_t *h;
     bcf1_t *v;
+    int32_t rid;
+    int32_t pos1;
+    int32_t end1;
 
     GenotypingRecord();
 
     GenotypingRecord(bcf_hdr_t *h, bcf1_t *v);
 
-    ~GenotypingRecord();
+    virtual ~GenotypingRecord();
 
     /**
      * Sets a bcf record.
@@ -53,7 +59,7 @@ class GenotypingRecord
     /**
      * Genotypes a read and add to body of evidence.
      */
-    virtual void genotype(bam1_t *s, int32_t sample_id);
+    virtual void genotype(GenotypingRead *read);
         
     /**
      * Prints record.
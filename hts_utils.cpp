@@ -22,6 +22,8 @@
 */
 
 #include "hts_utils.h"
+#include <unistd.h>
+#include <sys/stat.h>
 
 KHASH_MAP_INIT_STR(vdict, bcf_idinfo_t)
 typedef khash_t(vdict) vdict_t;
@@ -45,10 +47,49 @@ void bam_hdr_transfer_contigs_to_bcf_hdr(const bam_hdr_t *sh, bcf_hdr_t *vh)
     if (s.m) free(s.s);
 }
 
+/**
+ * Gets the sample name from the SM tag of the first read group in a bam header.
+ * s is left empty if there is none.
+ */
+void bam_hdr_get_sample_name(const bam_hdr_t *sh, kstring_t *s)
+{
+    s->l = 0;
+    if (!sh->text) return;
+
+    const char* rg = sh->text;
+    while ((rg = strstr(rg, "@RG")))
+    {
+        if (rg==sh->text || rg[-1]=='\n')
+        {
+            const char* eol = strchr(rg, '\n');
+            if (!eol) eol = rg + strlen(rg);
+
+            const char* sm = strstr(rg, "\tSM:");
+            if (sm && sm<eol)
+            {
+                sm += 4;
+                const char* end = sm;
+                while (end<eol && *end!='\t' && *end!='\r') ++end;
+                kputsn(sm, end-sm, s);
+                return;
+            }
+        }
+        rg += 3;
+    }
+}
+
 /**********
  *BAM UTILS
  **********/
 
+/**
+ * Gets the end position of the last mapped base in the read.
+ */
+int32_t bam_get_end_pos1(bam1_t *srec)
+{
+    return bam_endpos(srec);
+};
+
 /**
  * Gets the read sequence from a bam record
  */
@@ -153,6 +194,57 @@ void bam_get_cigar_expanded_string(bam1_t *s, kstring_t *cigar_expanded_string)
     if (token.m) free(token.s);
 }
 
+/**
+ * Gets the base in the read that is mapped to a genomic position.
+ * Returns -1 if it does not exists.
+ */
+void bam_get_base_and_qual(bam1_t *srec, uint32_t pos, char& base, char& qual, int32_t& rpos)
+{
+    bam1_core_t *c = &srec->core;
+    uint32_t cpos = c->pos; //reference coordinates of the first mapped base
+    rpos = BAM_READ_INDEX_NA; //read coordinates
+
+    base = 'N';
+    qual = 0;
+
+    int32_t qpos = 0;
+    uint32_t *cigar = bam_get_cigar(srec);
+    for (uint32_t i = 0; i < c->n_cigar; ++i)
+    {
+        int32_t op = bam_cigar_op(cigar[i]);
+        uint32_t len = bam_cigar_oplen(cigar[i]);
+        int32_t type = bam_cigar_type(op);
+
+        //consumes reference
+        if (type&2)
+        {
+            if (pos>=cpos && pos<=cpos+len-1)
+            {
+                //no base for deletions and reference skips
+                if (type&1)
+                {
+                    rpos = qpos + (pos-cpos);
+                }
+                break;
+            }
+
+            cpos += len;
+        }
+
+        //consumes query
+        if (type&1)
+        {
+            qpos += len;
+        }
+    }
+
+    if (rpos!=BAM_READ_INDEX_NA)
+    {
+        base = "=ACMGRSVTWYHKDBN"[bam_seqi(bam_get_seq(srec), rpos)];
+        qual = bam_get_qual(srec)[rpos] + 33;
+    }
+};
+
 /**
  * Gets the base in the read that is mapped to a genomic position.
  * Extracts the read sequence and aualities too.
@@ -391,6 +483,96 @@ void bcf_hdr_get_seqs_and_lens(const bcf_hdr_t *h, const char**& seqs, int32_t*&
     *n = m;
 }
 
+/**************
+ *HTS FILE UTILS
+ **************/
+
+/**
+ * Opens an existing file for writing after truncating it to offset,
+ * subsequent writes are appended.  The mode is as for hts_open.
+ *
+ * offset is a virtual offset at a block boundary for BGZF output and
+ * a byte offset otherwise, as returned by hts_flush_and_tell.
+ */
+htsFile *hts_open_truncated(const char *fn, const char *mode, int64_t offset)
+{
+    bool is_bin = strchr(mode, 'b')!=NULL;
+    int32_t is_compressed = strchr(mode, 'z') ? 1 : (strchr(mode, 'u') ? 0 : 2);
+    bool is_bgzf = is_bin || is_compressed==1;
+    int64_t length = is_bgzf ? (offset>>16) : offset;
+
+    if (is_bgzf && (offset&0xFFFF))
+    {
+        fprintf(stderr, "[E:%s:%d %s] offset %lld is not at a block boundary in %s\n", __FILE__, __LINE__, __FUNCTION__, (long long) offset, fn);
+        return NULL;
+    }
+
+    struct stat st;
+    if (stat(fn, &st))
+    {
+        fprintf(stderr, "[E:%s:%d %s] cannot stat %s\n", __FILE__, __LINE__, __FUNCTION__, fn);
+        return NULL;
+    }
+
+    //the output was not fully written out when the offset was recorded
+    if (length>st.st_size)
+    {
+        fprintf(stderr, "[E:%s:%d %s] offset %lld lies beyond the end of %s (%lld bytes)\n", __FILE__, __LINE__, __FUNCTION__, (long long) length, fn, (long long) st.st_size);
+        return NULL;
+    }
+
+    if (truncate(fn, length))
+    {
+        fprintf(stderr, "[E:%s:%d %s] cannot truncate %s to %lld bytes\n", __FILE__, __LINE__, __FUNCTION__, fn, (long long) length);
+        return NULL;
+    }
+
+    hFILE *hfile = hopen(fn, "a");
+    if (!hfile)
+    {
+        fprintf(stderr, "[E:%s:%d %s] cannot open %s for appending\n", __FILE__, __LINE__, __FUNCTION__, fn);
+        return NULL;
+    }
+    hfile->offset = length;
+
+    htsFile *fp = (htsFile*) calloc(1, sizeof(htsFile));
+    fp->fn = strdup(fn);
+    fp->is_be = ed_is_big();
+    fp->is_write = 1;
+    fp->is_bin = is_bin;
+    fp->is_compressed = is_compressed;
+
+    if (is_bgzf)
+    {
+        fp->fp.bgzf = bgzf_hopen(hfile, mode);
+        fp->fp.bgzf->block_address = length;
+    }
+    else
+    {
+        fp->fp.hfile = hfile;
+    }
+
+    return fp;
+}
+
+/**
+ * Flushes a file opened for writing to disk and returns the offset of the end of the output.
+ */
+int64_t hts_flush_and_tell(htsFile *fp)
+{
+    if (fp->is_bin || fp->is_compressed==1)
+    {
+        //bgzf_flush only hands the compressed blocks to the underlying hFILE
+        if (bgzf_flush(fp->fp.bgzf) || hflush(fp->fp.bgzf->fp)) return -1;
+        return bgzf_tell(fp->fp.bgzf);
+    }
+    else
+    {
+        if (hflush(fp->fp.hfile)) return -1;
+        return htell(fp->fp.hfile);
+    }
+}
+
 /**********
  *BCF UTILS
  **********/
@@ -500,9 +682,9 @@ void bcf_alleles2string_sorted(bcf_hdr_t *h, bcf1_t *v, kstring_t *var)
 }
 
 /**
- *Set chromosome name
+ *Get RID of a chromosome, the chromosome is added to the header if absent
  */
-void bcf_set_chrom(bcf_hdr_t *h, bcf1_t *v, const char* chrom)
+int32_t bcf_hdr_get_rid(bcf_hdr_t *h, const char* chrom)
 {
     vdict_t *d = (vdict_t*)h->dict[BCF_DT_CTG];
     khint_t k = kh_get(vdict, d, chrom);
@@ -515,6 +697,249 @@ void bcf_set_chrom(bcf_hdr_t *h, bcf1_t *v, const char* chrom)
         if (contig.m) free(contig.s);
         k = kh_get(vdict, d, chrom);
     }
-    v->rid = kh_val(d, k).id;
+    return kh_val(d, k).id;
+};
+
+/**
+ *Set chromosome name
+ */
+void bcf_set_chrom(bcf_hdr_t *h, bcf1_t *v, const char* chrom)
+{
+    v->rid = bcf_hdr_get_rid(h, chrom);
+};
+
+/*******************
+ *BCF RECORD BUILDER
+ *******************/
+
+/**
+ * Constructor.
+ */
+BCFRecordBuilder::BCFRecordBuilder(bcf_hdr_t *h)
+{
+    this->h = h;
+    no_samples = bcf_hdr_nsamples(h);
+    chrom = {0,0,0};
+    rid = -1;
+    pos0 = 0;
+    alleles = {0,0,0};
+    n_allele = 0;
+    rlen = 0;
+};
+
+/**
+ * Destructor.
+ */
+BCFRecordBuilder::~BCFRecordBuilder()
+{
+    if (chrom.m) free(chrom.s);
+    if (alleles.m) free(alleles.s);
+    for (uint32_t i=0; i<info_tags.size(); ++i)
+    {
+        if (info_tags[i].value.m) free(info_tags[i].value.s);
+    }
+    for (uint32_t i=0; i<format_tags.size(); ++i)
+    {
+        if (format_tags[i].value.m) free(format_tags[i].value.s);
+    }
+};
+
+/**
+ * Adds a tag of header line type hl_type to tags.
+ */
+int32_t BCFRecordBuilder::add_tag(std::vector<Tag>& tags, int32_t hl_type, const char* key)
+{
+    int32_t id = bcf_hdr_id2int(h, BCF_DT_ID, key);
+    if (!bcf_hdr_idinfo_exists(h, hl_type, id))
+    {
+        fprintf(stderr, "[E:%s:%d %s] %s tag '%s' is not defined in the header\n", __FILE__, __LINE__, __FUNCTION__, hl_type==BCF_HL_INFO ? "INFO" : "FORMAT", key);
+        exit(1);
+    }
+
+    Tag tag;
+    tag.id = id;
+    //genotypes are encoded as integers whatever the declared type
+    tag.type = (hl_type==BCF_HL_FMT && !strcmp(key, "GT")) ? BCF_HT_INT : bcf_hdr_id2type(h, hl_type, id);
+    tag.set = false;
+    tag.value = {0,0,0};
+    tags.push_back(tag);
+
+    return tags.size()-1;
+};
+
+/**
+ * Adds an INFO tag, returns the handle for setting its values.
+ */
+int32_t BCFRecordBuilder::add_info_tag(const char* key)
+{
+    return add_tag(info_tags, BCF_HL_INFO, key);
+};
+
+/**
+ * Adds a FORMAT tag, returns the handle for setting its values.
+ */
+int32_t BCFRecordBuilder::add_format_tag(const char* key)
+{
+    return add_tag(format_tags, BCF_HL_FMT, key);
+};
+
+/**
+ * Sets chromosome, the RID is looked up only when the chromosome changes.
+ */
+void BCFRecordBuilder::set_chrom(const char* chrom)
+{
+    if (rid<0 || strcmp(chrom, this->chrom.s))
+    {
+        rid = bcf_hdr_get_rid(h, chrom);
+        this->chrom.l = 0;
+        kputs(chrom, &this->chrom);
+    }
+};
+
+/**
+ * Sets alleles from a comma separated string, the first allele is the reference.
+ */
+void BCFRecordBuilder::set_alleles(const char* alleles)
+{
+    this->alleles.l = 0;
+    n_allele = 0;
+    const char *p = alleles;
+    while (true)
+    {
+        const char *q = p;
+        while (*q && *q!=',') ++q;
+        if (!n_allele) rlen = q-p;
+        bcf_enc_vchar(&this->alleles, q-p, p);
+        ++n_allele;
+        if (!*q) break;
+        p = q+1;
+    }
+};
+
+/**
+ * Sets alleles, the first allele is the reference.
+ */
+void BCFRecordBuilder::set_alleles(const char** alleles, int32_t n)
+{
+    this->alleles.l = 0;
+    n_allele = n;
+    rlen = n ? strlen(alleles[0]) : 0;
+    for (int32_t i=0; i<n; ++i)
+    {
+        bcf_enc_vchar(&this->alleles, strlen(alleles[i]), alleles[i]);
+    }
 };
 
+/**
+ * Checks the type of a tag and marks it set, its value buffer is returned cleared.
+ */
+kstring_t* BCFRecordBuilder::set_tag(std::vector<Tag>& tags, int32_t tag, int32_t type)
+{
+    Tag& t = tags[tag];
+    if (t.type!=type)
+    {
+        fprintf(stderr, "[E:%s:%d %s] tag '%s' is set with the wrong type\n", __FILE__, __LINE__, __FUNCTION__, bcf_hdr_int2id(h, BCF_DT_ID, t.id));
+        exit(1);
+    }
+    t.set = true;
+    t.value.l = 0;
+    return &t.value;
+};
+
+/**
+ * Sets the values of an INFO tag of type Integer.
+ */
+void BCFRecordBuilder::set_info_int32(int32_t tag, const int32_t* values, int32_t n)
+{
+    bcf_enc_vint(set_tag(info_tags, tag, BCF_HT_INT), n, const_cast<int32_t*>(values), -1);
+};
+
+/**
+ * Sets the values of an INFO tag of type Float.
+ */
+void BCFRecordBuilder::set_info_float(int32_t tag, const float* values, int32_t n)
+{
+    bcf_enc_vfloat(set_tag(info_tags, tag, BCF_HT_REAL), n, const_cast<float*>(values));
+};
+
+/**
+ * Sets the value of an INFO tag of type String.
+ */
+void BCFRecordBuilder::set_info_string(int32_t tag, const char* value)
+{
+    bcf_enc_vchar(set_tag(info_tags, tag, BCF_HT_STR), strlen(value), value);
+};
+
+/**
+ * Sets an INFO tag of type Flag.
+ */
+void BCFRecordBuilder::set_info_flag(int32_t tag)
+{
+    bcf_enc_size(set_tag(info_tags, tag, BCF_HT_FLAG), 0, BCF_BT_NULL);
+};
+
+/**
+ * Sets the values of a FORMAT tag of type Integer, n is the number of values for all samples.
+ */
+void BCFRecordBuilder::set_format_int32(int32_t tag, const int32_t* values, int32_t n)
+{
+    bcf_enc_vint(set_tag(format_tags, tag, BCF_HT_INT), n, const_cast<int32_t*>(values), n/no_samples);
+};
+
+/**
+ * Sets the values of a FORMAT tag of type Float, n is the number of values for all samples.
+ */
+void BCFRecordBuilder::set_format_float(int32_t tag, const float* values, int32_t n)
+{
+    kstring_t *value = set_tag(format_tags, tag, BCF_HT_REAL);
+    bcf_enc_size(value, n/no_samples, BCF_BT_FLOAT);
+    kputsn((char*)values, n*sizeof(float), value);
+};
+
+/**
+ * Serialises the record into v and clears the values for the next record.
+ */
+void BCFRecordBuilder::build(bcf1_t *v)
+{
+    bcf_clear(v);
+    v->rid = rid;
+    v->pos = pos0;
+    v->rlen = rlen;
+    v->n_allele = n_allele;
+
+    //ID, alleles, FILTER and INFO
+    kstring_t *s = &v->shared;
+    bcf_enc_size(s, 0, BCF_BT_CHAR);
+    kputsn(alleles.s, alleles.l, s);
+    bcf_enc_vint(s, 0, 0, -1);
+    int32_t n_info = 0;
+    for (uint32_t i=0; i<info_tags.size(); ++i)
+    {
+        Tag& t = info_tags[i];
+        if (t.set)
+        {
+            bcf_enc_int1(s, t.id);
+            kputsn(t.value.s, t.value.l, s);
+            t.set = false;
+            ++n_info;
+        }
+    }
+    v->n_info = n_info;
+
+    //FORMAT and samples
+    s = &v->indiv;
+    int32_t n_fmt = 0;
+    for (uint32_t i=0; i<format_tags.size(); ++i)
+    {
+        Tag& t = format_tags[i];
+        if (t.set)
+        {
+            bcf_enc_int1(s, t.id);
+            kputsn(t.value.s, t.value.l, s);
+            t.set = false;
+            ++n_fmt;
+        }
+    }
+    v->n_fmt = n_fmt;
+    v->n_sample = no_samples;
+};
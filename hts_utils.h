@@ -40,6 +40,8 @@
 #include "htslib/sam.h"
 #include "htslib/vcf.h"
 #include "htslib/vcfutils.h"
+#include "htslib/bgzf.h"
+#include "hfile.h"
 #include "utils.h"
 
 /**************
@@ -51,6 +53,12 @@
  */
 void bam_hdr_transfer_contigs_to_bcf_hdr(const bam_hdr_t *sh, bcf_hdr_t *vh);
 
+/**
+ * Gets the sample name from the SM tag of the first read group in a bam header.
+ * s is left empty if there is none.
+ */
+void bam_hdr_get_sample_name(const bam_hdr_t *sh, kstring_t *s);
+
 /**
  * Get number of sequences.
  */
@@ -210,6 +218,25 @@ bcf_hdr_t *bcf_alt_hdr_read(htsFile *fp);
  */
 int bcf_hdr_subset_samples(const bcf_hdr_t *h, bcf1_t *v, std::vector<int32_t>& imap);
 
+/**************
+ *HTS FILE UTILS
+ **************/
+
+/**
+ * Opens an existing file for writing after truncating it to offset,
+ * subsequent writes are appended.  The mode is as for hts_open.
+ *
+ * offset is a virtual offset at a block boundary for BGZF output and
+ * a byte offset otherwise, as returned by hts_flush_and_tell.  Fails if
+ * the offset lies beyond the end of the file.
+ */
+htsFile *hts_open_truncated(const char *fn, const char *mode, int64_t offset);
+
+/**
+ * Flushes a file opened for writing to disk and returns the offset of the end of the output.
+ */
+int64_t hts_flush_and_tell(htsFile *fp);
+
 /**********
  *BCF UTILS
  **********/
@@ -259,6 +286,11 @@ void bcf_print_liten(bcf_hdr_t *h, bcf1_t *v);
  */
 #define bcf_get_chrom(h, v) ((h)->id[BCF_DT_CTG][(v)->rid].key)
 
+/**
+ * Get RID of a chromosome, the chromosome is added to the header if absent
+ */
+int32_t bcf_hdr_get_rid(bcf_hdr_t *h, const char* chrom);
+
 /**
  * Set chromosome name
  */
@@ -344,4 +376,139 @@ bool bcf_is_passed(bcf_hdr_t *h, bcf1_t *v);
  */
 #define bcf_set_n_sample(v, n) ((v)->n_sample = (n));
 
+/*******************
+ *BCF RECORD BUILDER
+ *******************/
+
+/**
+ * Builds records for a header from scratch.
+ *
+ * INFO and FORMAT tags are looked up in the header once when added,
+ * values set for a record are encoded into buffers that are reused
+ * across records and build() serialises the shared and individual
+ * blocks of the record in one pass.  Tags are written in the order
+ * they were added, so GT should be the first FORMAT tag added.
+ *
+ *   BCFRecordBuilder rb(odw->hdr);
+ *   int32_t E = rb.add_format_tag("E");
+ *
+ *   rb.set_chrom(chrom);
+ *   rb.set_pos1(pos1);
+ *   rb.set_alleles("A,T");
+ *   rb.set_format_int32(E, &e, 1);
+ *   rb.build(v = odw->get_bcf1_from_pool());
+ */
+class BCFRecordBuilder
+{
+    public:
+
+    /**
+     * Constructor.
+     */
+    BCFRecordBuilder(bcf_hdr_t *h);
+
+    /**
+     * Destructor.
+     */
+    ~BCFRecordBuilder();
+
+    /**
+     * Adds an INFO tag, returns the handle for setting its values.
+     */
+    int32_t add_info_tag(const char* key);
+
+    /**
+     * Adds a FORMAT tag, returns the handle for setting its values.
+     */
+    int32_t add_format_tag(const char* key);
+
+    /**
+     * Sets chromosome, the RID is looked up only when the chromosome changes.
+     */
+    void set_chrom(const char* chrom);
+
+    /**
+     * Sets 1-based position.
+     */
+    void set_pos1(int32_t pos1) { pos0 = pos1-1; };
+
+    /**
+     * Sets alleles from a comma separated string, the first allele is the reference.
+     */
+    void set_alleles(const char* alleles);
+
+    /**
+     * Sets alleles, the first allele is the reference.
+     */
+    void set_alleles(const char** alleles, int32_t n);
+
+    /**
+     * Sets the values of an INFO tag of type Integer.
+     */
+    void set_info_int32(int32_t tag, const int32_t* values, int32_t n);
+
+    /**
+     * Sets the values of an INFO tag of type Float.
+     */
+    void set_info_float(int32_t tag, const float* values, int32_t n);
+
+    /**
+     * Sets the value of an INFO tag of type String.
+     */
+    void set_info_string(int32_t tag, const char* value);
+
+    /**
+     * Sets an INFO tag of type Flag.
+     */
+    void set_info_flag(int32_t tag);
+
+    /**
+     * Sets the values of a FORMAT tag of type Integer, n is the number of values for all samples.
+     */
+    void set_format_int32(int32_t tag, const int32_t* values, int32_t n);
+
+    /**
+     * Sets the values of a FORMAT tag of type Float, n is the number of values for all samples.
+     */
+    void set_format_float(int32_t tag, const float* values, int32_t n);
+
+    /**
+     * Serialises the record into v and clears the values for the next record.
+     */
+    void build(bcf1_t *v);
+
+    private:
+
+    struct Tag
+    {
+        int32_t id;
+        int32_t type;
+        bool set;
+        kstring_t value;
+    };
+
+    bcf_hdr_t *h;
+    int32_t no_samples;
+
+    kstring_t chrom;
+    int32_t rid;
+    int32_t pos0;
+    kstring_t alleles;
+    int32_t n_allele;
+    int32_t rlen;
+
+    std::vector<Tag> info_tags;
+    std::vector<Tag> format_tags;
+
+    /**
+     * Adds a tag of header line type hl_type to tags.
+     */
+    int32_t add_tag(std::vector<Tag>& tags, int32_t hl_type, const char* key);
+
+    /**
+     * Checks the type of a tag and marks it set, its value buffer is returned cleared.
+     */
+    kstring_t* set_tag(std::vector<Tag>& tags, int32_t tag, int32_t type);
+};
+
 #endif
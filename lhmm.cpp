@@ -23,9 +23,304 @@
 
 #include "lhmm.h"
 
+namespace
+{
+
+enum {LX=0, LY, LM, LI, LD, LW, LZ};
+
+/**
+ * Orders probes lexicographically by their index.
+ */
+struct LHMMProbeOrder
+{
+    const char** probes;
+
+    LHMMProbeOrder(const char** probes) : probes(probes) {};
+
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        return strcmp(probes[a], probes[b])<0;
+    }
+};
+
+/**
+ * Orders reads by their length.
+ */
+struct LHMMReadOrder
+{
+    const uint32_t* lens;
+
+    LHMMReadOrder(const uint32_t* lens) : lens(lens) {};
+
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        return lens[a]<lens[b];
+    }
+};
+
+/**
+ * Reads aligned at once by the probe kernel, one in each lane, and where
+ * their log odds against the probes go.
+ */
+struct LHMMLanes
+{
+    uint32_t no_lanes;
+    const char* reads[LHMM_QUANTIZED_BATCH_SIZE];
+    uint32_t lens[LHMM_QUANTIZED_BATCH_SIZE];
+    const uint8_t* qclasses[LHMM_QUANTIZED_BATCH_SIZE];
+    double* llks[LHMM_QUANTIZED_BATCH_SIZE];
+};
+
+/**
+ * Converts log odds to a score of type S, rounded to the nearest 1/Q for
+ * quantized scores.
+ */
+template<class S, int Q>
+inline S lhmm_score(double x)
+{
+    return Q ? (S) lrint(x*Q) : (S) x;
+}
+
+/**
+ * Aligns the reads in the N lanes of VF against the probes walked as a trie,
+ * see LHMM::align_probes, with scores of type S in the lanes of VF and the
+ * integers of type I in the lanes of VI, which has the width of VF, holding
+ * the read bases.  VF and VI are S and I when N is 1.  The reads are padded
+ * to the longest with N bases, the cells past the end of a read do not
+ * affect the cells up to it.
+ *
+ * The recurrence is that of LHMM::compute_cell with the same additions in
+ * the same order, so the log odds are those of align_probes bit for bit.
+ *
+ * If Q is not 0, the scores are integers in units of 1/Q, the transitions
+ * and emissions are rounded to these units and the scores are clamped at
+ * LHMM_QUANTIZED_FLOOR so that they cannot wrap around, see
+ * LHMM::align_probes_batch for the reads that fit.
+ */
+template<class S, class I, class VF, class VI, int N, int Q>
+inline __attribute__((always_inline)) void lhmm_probe_kernel(LHMM& h, const char** probes, LHMMLanes& lanes)
+{
+    uint32_t ylen = 0;
+    for (uint32_t l=0; l<lanes.no_lanes; ++l)
+    {
+        ylen = std::max(ylen, lanes.lens[l]);
+    }
+
+    //score rows of the 7 states, then the read bases and emissions by column
+    uint32_t stride = ylen+1;
+    size_t rows_size = ((3+h.probeDepths.size())*7*stride*sizeof(VF)+63)/64*64;
+    size_t column_size = (stride*sizeof(VF)+63)/64*64;
+    h.kernelBuffer.resize(1, rows_size+3*column_size);
+    VF* rows = (VF*) h.kernelBuffer.data;
+    VI* ybase = (VI*) (h.kernelBuffer.data+rows_size);
+    VF* match = (VF*) (h.kernelBuffer.data+rows_size+column_size);
+    VF* mismatch = (VF*) (h.kernelBuffer.data+rows_size+2*column_size);
+
+    for (uint32_t j=1; j<=ylen; ++j)
+    {
+        for (uint32_t l=0; l<N; ++l)
+        {
+            I& b = ((I*) &ybase[j])[l];
+            S& m = ((S*) &match[j])[l];
+            S& mm = ((S*) &mismatch[j])[l];
+            if (l<lanes.no_lanes && j<=lanes.lens[l] && lanes.reads[l][j-1]!='N')
+            {
+                b = lanes.reads[l][j-1];
+                m = lhmm_score<S, Q>(h.logMatchOdds[lanes.qclasses[l][j-1]]);
+                mm = lhmm_score<S, Q>(h.logMismatchOdds[lanes.qclasses[l][j-1]]);
+            }
+            else
+            {
+                b = 'N';
+                m = mm = 0;
+            }
+        }
+    }
+
+    VF zero = VF() + (S) 0;
+    VF lowest = VF() + (S) (Q ? LHMM_QUANTIZED_FLOOR : -DBL_MAX);
+    VF txx = VF() + lhmm_score<S, Q>(h.txx), txy = VF() + lhmm_score<S, Q>(h.txy), tyy = VF() + lhmm_score<S, Q>(h.tyy);
+    VF txm = VF() + lhmm_score<S, Q>(h.txm), tym = VF() + lhmm_score<S, Q>(h.tym), tsm = VF() + lhmm_score<S, Q>(h.tsm);
+    VF tmm = VF() + lhmm_score<S, Q>(h.tmm), tim = VF() + lhmm_score<S, Q>(h.tim), tdm = VF() + lhmm_score<S, Q>(h.tdm);
+    VF tmd = VF() + lhmm_score<S, Q>(h.tmd), tdd = VF() + lhmm_score<S, Q>(h.tdd), tmi = VF() + lhmm_score<S, Q>(h.tmi);
+    VF tii = VF() + lhmm_score<S, Q>(h.tii), tmw = VF() + lhmm_score<S, Q>(h.tmw), tww = VF() + lhmm_score<S, Q>(h.tww);
+    VF tmz = VF() + lhmm_score<S, Q>(h.tmz), twz = VF() + lhmm_score<S, Q>(h.twz), tzz = VF() + lhmm_score<S, Q>(h.tzz);
+
+    //row 0
+    std::fill(rows, rows+7*stride, lowest);
+    rows[LY*stride] = zero;
+    rows[LZ*stride] = zero;
+    for (uint32_t j=1; j<=ylen; ++j)
+    {
+        rows[LY*stride+j] = rows[LY*stride+j-1] + tyy;
+        rows[LZ*stride+j] = rows[LZ*stride+j-1] + tzz;
+    }
+    rows[LY*stride] = lowest;
+    rows[LZ*stride] = lowest;
+    rows[LM*stride] = zero;
+
+    VF* prev[7];
+    VF* cur[7];
+    for (uint32_t k=0; k<h.probeOrder.size(); ++k)
+    {
+        const char* x = probes[h.probeOrder[k]];
+        uint32_t xlen = strlen(x);
+
+        //rows of the prefix shared with the previous probe are still valid
+        uint32_t shared = h.probeStarts[k];
+        uint32_t prev_slot = shared ? 3+(std::lower_bound(h.probeDepths.begin(), h.probeDepths.end(), shared)-h.probeDepths.begin()) : 0;
+
+        //leading gaps in the probe on column 0
+        VF xc = zero, wc = zero;
+        for (uint32_t i=1; i<=shared; ++i)
+        {
+            xc += txx;
+            wc += tww;
+        }
+
+        for (uint32_t i=shared+1; i<=xlen; ++i)
+        {
+            std::vector<uint32_t>::iterator d = std::lower_bound(h.probeDepths.begin(), h.probeDepths.end(), i);
+            uint32_t slot = d!=h.probeDepths.end() && *d==i ? 3+(d-h.probeDepths.begin()) : (prev_slot==1 ? 2 : 1);
+            for (uint32_t s=0; s<7; ++s)
+            {
+                prev[s] = rows+(prev_slot*7+s)*stride;
+                cur[s] = rows+(slot*7+s)*stride;
+                cur[s][0] = lowest;
+            }
+            xc += txx;
+            wc += tww;
+            cur[LX][0] = xc;
+            cur[LW][0] = wc;
+
+            bool xn = x[i-1]=='N';
+            VI xb = VI() + (I) x[i-1];
+            for (uint32_t j=1; j<=ylen; ++j)
+            {
+                VF max, v;
+
+                //X
+                v = prev[LX][j] + txx;
+                if (Q) v = lowest>v ? lowest : v;
+                cur[LX][j] = v;
+
+                //Y
+                max = cur[LX][j-1] + txy;
+                v = cur[LY][j-1] + tyy; max = v>max ? v : max;
+                if (Q) max = lowest>max ? lowest : max;
+                cur[LY][j] = max;
+
+                //M
+                max = prev[LX][j-1] + txm;
+                v = prev[LY][j-1] + tym; max = v>max ? v : max;
+                v = prev[LM][j-1] + ((i==1&&j==1) ? tsm : tmm); max = v>max ? v : max;
+                v = prev[LI][j-1] + tim; max = v>max ? v : max;
+                v = prev[LD][j-1] + tdm; max = v>max ? v : max;
+                max += xn ? zero : (ybase[j]==xb ? match[j] : mismatch[j]);
+                if (Q) max = lowest>max ? lowest : max;
+                cur[LM][j] = max;
+
+                //D
+                max = prev[LM][j] + tmd;
+                v = prev[LD][j] + tdd; max = v>max ? v : max;
+                if (Q) max = lowest>max ? lowest : max;
+                cur[LD][j] = max;
+
+                //I
+                max = cur[LM][j-1] + tmi;
+                v = cur[LI][j-1] + tii; max = v>max ? v : max;
+                if (Q) max = lowest>max ? lowest : max;
+                cur[LI][j] = max;
+
+                //W
+                max = prev[LM][j] + tmw;
+                v = prev[LW][j] + tww; max = v>max ? v : max;
+                if (Q) max = lowest>max ? lowest : max;
+                cur[LW][j] = max;
+
+                //Z
+                max = cur[LM][j-1] + tmz;
+                v = cur[LW][j-1] + twz; max = v>max ? v : max;
+                v = cur[LZ][j-1] + tzz; max = v>max ? v : max;
+                if (Q) max = lowest>max ? lowest : max;
+                cur[LZ][j] = max;
+            }
+
+            prev_slot = slot;
+        }
+
+        //best of the end states of each read, as in tracePath
+        VF* last = rows+prev_slot*7*stride;
+        for (uint32_t l=0; l<lanes.no_lanes; ++l)
+        {
+            uint32_t j = lanes.lens[l];
+            double scale = Q ? Q : 1;
+            double llk = ((S*) &last[LM*stride+j])[l]/scale + h.logTau-h.logEta;
+            double w = ((S*) &last[LW*stride+j])[l]/scale;
+            double z = ((S*) &last[LZ*stride+j])[l]/scale;
+            if (w>llk)
+            {
+                llk = w;
+            }
+            if (z>llk)
+            {
+                llk = z;
+            }
+            lanes.llks[l][h.probeOrder[k]] = llk;
+        }
+    }
+}
+
+typedef double lhmm_v4d __attribute__((vector_size(32)));
+typedef int64_t lhmm_v4l __attribute__((vector_size(32)));
+typedef int16_t lhmm_v16s __attribute__((vector_size(32)));
+
+void lhmm_probes(LHMM& h, const char** probes, LHMMLanes& lanes)
+{
+    lhmm_probe_kernel<double, int64_t, double, int64_t, 1, 0>(h, probes, lanes);
+}
+
+void lhmm_probes_v4d(LHMM& h, const char** probes, LHMMLanes& lanes)
+{
+    lhmm_probe_kernel<double, int64_t, lhmm_v4d, lhmm_v4l, 4, 0>(h, probes, lanes);
+}
+
+void lhmm_probes_v16s(LHMM& h, const char** probes, LHMMLanes& lanes)
+{
+    lhmm_probe_kernel<int16_t, int16_t, lhmm_v16s, lhmm_v16s, 16, LHMM_QUANTIZED_SCALE>(h, probes, lanes);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LHMM_X86
+
+__attribute__((target("avx2"))) void lhmm_probes_v4d_avx2(LHMM& h, const char** probes, LHMMLanes& lanes)
+{
+    lhmm_probe_kernel<double, int64_t, lhmm_v4d, lhmm_v4l, 4, 0>(h, probes, lanes);
+}
+
+__attribute__((target("avx2"))) void lhmm_probes_v16s_avx2(LHMM& h, const char** probes, LHMMLanes& lanes)
+{
+    lhmm_probe_kernel<int16_t, int16_t, lhmm_v16s, lhmm_v16s, 16, LHMM_QUANTIZED_SCALE>(h, probes, lanes);
+}
+#endif
+
+/**
+ * Returns true if the CPU supports AVX2.
+ */
+bool lhmm_has_avx2()
+{
+#ifdef LHMM_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+}
+
 LHMM::LHMM()
 {
-    maxLength = 2000;
 
 //  delta = 0.01;
 //  epsilon = 0.1;
@@ -55,6 +350,16 @@ LHMM::LHMM()
 
     logOneSixteenth = log10(1.0/16.0);
 
+    //emission tables, the last class holds the cap applied by pl2prob
+    for (uint32_t k=0; k<LHMM_NO_QUAL_CLASSES; ++k)
+    {
+        double e = pl2prob(k<LHMM_NO_QUAL_CLASSES-1 ? k : 3236);
+        logMatchOdds[k] = logEmissionOdds('A', 'A', e);
+        logMismatchOdds[k] = logEmissionOdds('A', 'C', e);
+        logMatch[k] = logEmission('A', 'A', e);
+        logMismatch[k] = logEmission('A', 'C', e);
+    }
+
     //for matched portion
     tMM = log10(1-2*delta-tau);
     tMI = log10(delta);
@@ -88,64 +393,76 @@ LHMM::LHMM()
     twz = log10((eta*(1-eta))/(eta*(1-eta)));
     tzz = log10((1-eta)/(1-eta));
 
-    //assume alignments can't possibly be maxLength bases or more
-    //todo:: allow for resizing if you do encounter fragments which are really long
-    std::vector<double> temp(maxLength+1, -DBL_MAX);
-    std::vector<char> tempX(maxLength+1, 'Y');
-    tempX[0] = 'X';
-    std::vector<char> tempY(maxLength+1, 'Y');
-    tempY[0] = 'X';
-
-    for (uint32_t i=0; i<maxLength+1; ++i)
-    {
-        X.push_back(temp);
-        Y.push_back(temp);
-        M.push_back(temp);
-        I.push_back(temp);
-        D.push_back(temp);
-        W.push_back(temp);
-        Z.push_back(temp);
-        pathX.push_back(tempX);
-        pathY.push_back(tempY);
-        pathM.push_back(tempX);
-        pathD.push_back(tempX);
-        pathI.push_back(tempX);
-        pathW.push_back(tempX);
-        pathZ.push_back(tempX);
-    }
-
     logEta = log10(eta);
     logTau = log10(tau);
 
+    qclasses = NULL;
+    avx2 = lhmm_has_avx2();
+
+    //a quantized score stays below INT16_MAX if the read bases all match at the
+    //best odds and the path takes the best transitions into M and out of it,
+    //each of these terms may round up by half a unit
+    quantized = false;
+    double max_score = std::max(tsm, std::max(txm, tym)) + std::max(tmw, tmz);
+    double max_match = 0;
+    for (uint32_t k=1; k<LHMM_NO_QUAL_CLASSES-1; ++k)
+    {
+        max_match = std::max(max_match, logMatchOdds[k]);
+    }
+    quantizedMaxLength = (INT16_MAX-(max_score*LHMM_QUANTIZED_SCALE+1))/(max_match*LHMM_QUANTIZED_SCALE+0.5);
+};
+
+/**
+ * Sizes the matrices for aligning x and y and initializes their boundaries.
+ */
+void LHMM::initialize_matrices(uint32_t xlen, uint32_t ylen)
+{
+    LHMMMatrix<double>* scores[7] = {&X, &Y, &M, &I, &D, &W, &Z};
+    for (uint32_t k=0; k<7; ++k)
+    {
+        LHMMMatrix<double>& m = *scores[k];
+        m.resize(xlen+1, ylen+1);
+        std::fill(m[0], m[0]+ylen+1, -DBL_MAX);
+        for (uint32_t i=1; i<=xlen; ++i)
+        {
+            m[i][0] = -DBL_MAX;
+        }
+    }
+
+    LHMMMatrix<char>* paths[7] = {&pathX, &pathY, &pathM, &pathI, &pathD, &pathW, &pathZ};
+    for (uint32_t k=0; k<7; ++k)
+    {
+        paths[k]->resize(xlen+1, ylen+1);
+    }
+
+    //leading gaps in the probe and the read
     X[0][0] = 0;
     Y[0][0] = 0;
-    M[0][0] = 0;
     W[0][0] = 0;
     Z[0][0] = 0;
-    pathX[0][0] = 'N';
-    pathX[1][0] = 'S';
-    pathY[0][0] = 'N';
-    pathY[0][1] = 'S';
-    pathM[0][0] = 'N';
-    pathM[1][1] = 'S';
-
-    for (uint32_t k=1; k<maxLength+1; ++k)
+    for (uint32_t k=1; k<=xlen; ++k)
     {
         X[k][0] = X[k-1][0] + txx;
-        X[0][k] = -DBL_MAX;
-        Y[k][0] = -DBL_MAX;
-        Y[0][k] = Y[0][k-1] + tyy;
         W[k][0] = W[k-1][0] + tww;
-        W[0][k] = -DBL_MAX;
-        Z[k][0] = -DBL_MAX;
+        pathX[k][0] = 'X';
+    }
+    for (uint32_t k=1; k<=ylen; ++k)
+    {
+        Y[0][k] = Y[0][k-1] + tyy;
         Z[0][k] = Z[0][k-1] + tzz;
+        pathY[0][k] = 'Y';
     }
-
     X[0][0] = -DBL_MAX;
     Y[0][0] = -DBL_MAX;
     W[0][0] = -DBL_MAX;
     Z[0][0] = -DBL_MAX;
+    M[0][0] = 0;
 
+    pathX[0][0] = 'N';
+    pathY[0][0] = 'N';
+    pathM[0][0] = 'N';
+    if (xlen) pathX[1][0] = 'S';
+    if (ylen) pathY[0][1] = 'S';
 };
 
 bool LHMM::containsIndel()
@@ -172,6 +489,19 @@ double LHMM::pl2prob(uint32_t PL)
     return PLs[PL];
 }
 
+/**
+ * Computes the quality classes of a read.
+ */
+void LHMM::set_quality_classes(const char* qual, uint32_t len)
+{
+    qualClasses.resize(len);
+    for (uint32_t j=0; j<len; ++j)
+    {
+        qualClasses[j] = quality_class(qual[j]);
+    }
+    qclasses = qualClasses.data();
+};
+
 /**
  *Updates matchStart, matchEnd, globalMaxPath and path.
  */
@@ -543,194 +873,423 @@ void LHMM::left_align()
 }
 
 /**
-Align and compute genotype likelihood.
-*/
-void LHMM::align(double& llk, const char* _x, const char* _y, const char* _qual, bool debug)
+ * Prints the score and path matrices.
+ */
+void LHMM::print_matrices()
 {
-    //std::cerr << "Running this\n" ;
-    x = _x;
-    y = _y;
-    qual = _qual;
+    std::cerr << "\n=X=\n";
+    printVector(X, xlen+1, ylen+1);
+    std::cerr << "\n=Y=\n";
+    printVector(Y, xlen+1, ylen+1);
+    std::cerr << "\n=M=\n";
+    printVector(M, xlen+1, ylen+1);
+    std::cerr << "\n=D=\n";
+    printVector(D, xlen+1, ylen+1);
+    std::cerr << "\n=I=\n";
+    printVector(I, xlen+1, ylen+1);
+    std::cerr << "\n=W=\n";
+    printVector(W, xlen+1, ylen+1);
+    std::cerr << "\n=Z=\n";
+    printVector(Z, xlen+1, ylen+1);
+    std::cerr << "\n=Path X=\n";
+    printVector(pathX, xlen+1, ylen+1);
+    std::cerr << "\n=Path Y=\n";
+    printVector(pathY, xlen+1, ylen+1);
+    std::cerr << "\n=Path M=\n";
+    printVector(pathM, xlen+1, ylen+1);
+    std::cerr << "\n=Path D=\n";
+    printVector(pathD, xlen+1, ylen+1);
+    std::cerr << "\n=Path I=\n";
+    printVector(pathI, xlen+1, ylen+1);
+    std::cerr << "\n=Path W=\n";
+    printVector(pathW, xlen+1, ylen+1);
+    std::cerr << "\n=Path Z=\n";
+    printVector(pathZ, xlen+1, ylen+1);
+};
 
-    //adds a starting character at the fron of each string that must be matched
-    xlen = strlen(x);
-    ylen = strlen(y);
+/**
+ * Gets rows i-1 and i of the score matrices and row i of the path matrices.
+ */
+void LHMM::get_rows(uint32_t i, double** prev, double** cur, char** path)
+{
+    LHMMMatrix<double>* scores[7] = {&X, &Y, &M, &I, &D, &W, &Z};
+    LHMMMatrix<char>* paths[7] = {&pathX, &pathY, &pathM, &pathI, &pathD, &pathW, &pathZ};
+    for (uint32_t s=0; s<7; ++s)
+    {
+        prev[s] = (*scores[s])[i-1];
+        cur[s] = (*scores[s])[i];
+        path[s] = (*paths[s])[i];
+    }
+};
+
+/**
+ * Computes the scores of all states for cell (i,j) from the rows i-1 and i
+ * of the states, and the paths if TRACE is set.
+ */
+template<bool TRACE>
+inline void LHMM::compute_cell(double* const* prev, double* const* cur, char* const* path, uint32_t i, uint32_t j)
+{
     double max = 0;
     char maxPath = 'X';
 
-    //std::cerr << "x: " << x << " " << xlen << "\n" ;
-    //std::cerr << "y: " << y << " " << ylen << "\n" ;
+    //X
+    double xx = prev[LX][j] + txx;
 
-    //construct possible solutions
-    for (uint32_t i=1; i<=xlen; ++i)
+    max = xx;
+    maxPath = 'X';
+
+    cur[LX][j] = max;
+    if (TRACE) path[LX][j] = maxPath;
+
+    //Y
+    double xy = cur[LX][j-1] + txy;
+    double yy = cur[LY][j-1] + tyy;
+
+    max = xy;
+    maxPath = 'X';
+
+    if (yy>max)
     {
-        for (uint32_t j=1; j<=ylen; ++j)
-        {
-            //std::cerr << i << " " << j  << "\n" ;
+        max = yy;
+        maxPath = 'Y';
+    }
 
-            //X
-            double xx = X[i-1][j] + txx;
+    cur[LY][j] = max;
+    if (TRACE) path[LY][j] = maxPath;
 
-            max = xx;
-            maxPath = 'X';
+    //M
+    double xm = prev[LX][j-1] + txm;
+    double ym = prev[LY][j-1] + tym;
+    double mm = prev[LM][j-1] + ((i==1&&j==1) ? tsm : tmm);
+    double im = prev[LI][j-1] + tim;
+    double dm = prev[LD][j-1] + tdm;
 
-            X[i][j] = max;
-            pathX[i][j] = maxPath;
+    max = xm;
+    maxPath = 'X';
 
-            //Y
-            double xy = X[i][j-1] + txy;
-            double yy = Y[i][j-1] + tyy;
+    if (ym>max) //special case
+    {
+        max = ym;
+        maxPath = 'Y';
+    }
+    if (mm>max)
+    {
+        max = mm;
+        maxPath = (i==1&&j==1) ? 'S' : 'M';
+    }
+    if (im>max)
+    {
+        max = im;
+        maxPath = 'I';
+    }
+    if (dm>max)
+    {
+        max = dm;
+        maxPath = 'D';
+    }
 
-            max = xy;
-            maxPath = 'X';
+    cur[LM][j] = max + log_emission_odds(x[i-1], y[j-1], qclasses[j-1]);
+    if (TRACE) path[LM][j] = maxPath;
 
-            if (yy>max)
-            {
-                max = yy;
-                maxPath = 'Y';
-            }
+    //D
+    double md = prev[LM][j] + tmd;
+    double dd = prev[LD][j] + tdd;
 
-            Y[i][j] = max;
-            pathY[i][j] = maxPath;
+    max = md;
+    maxPath = 'M';
 
-            //M
-            double xm = X[i-1][j-1] + txm;
-            double ym = Y[i-1][j-1] + tym;
-            double mm = M[i-1][j-1] + ((i==1&&j==1) ? tsm : tmm);
-            double im = I[i-1][j-1] + tim;
-            double dm = D[i-1][j-1] + tdm;
+    if (dd>max)
+    {
+        max = dd;
+        maxPath = 'D';
+    }
 
-            max = xm;
-            maxPath = 'X';
+    cur[LD][j] = max;
+    if (TRACE) path[LD][j] = maxPath;
 
-            if (ym>max) //special case
-            {
-                max = ym;
-                maxPath = 'Y';
-            }
-            if (mm>max)
-            {
-                max = mm;
-                maxPath = (i==1&&j==1) ? 'S' : 'M';
-            }
-            if (im>max)
-            {
-                max = im;
-                maxPath = 'I';
-            }
-            if (dm>max)
-            {
-                max = dm;
-                maxPath = 'D';
-            }
+    //I
+    double mi = cur[LM][j-1] + tmi;
+    double ii = cur[LI][j-1] + tii;
 
-            M[i][j] = max + logEmissionOdds(x[i-1], y[j-1], pl2prob((uint32_t) qual[j-1]-33));
-            pathM[i][j] = maxPath;
+    max = mi;
+    maxPath = 'M';
 
-            //D
-            double md = M[i-1][j] + tmd;
-            double dd = D[i-1][j] + tdd;
+    if (ii>max)
+    {
+        max = ii;
+        maxPath = 'I';
+    }
 
-            max = md;
-            maxPath = 'M';
+    cur[LI][j] = max;
+    if (TRACE) path[LI][j] = maxPath;
 
-            if (dd>max)
-            {
-                max = dd;
-                maxPath = 'D';
-            }
+    //W
+    double mw = prev[LM][j] + tmw;
+    double ww = prev[LW][j] + tww;
 
-            D[i][j] = max;
-            pathD[i][j] = maxPath;
+    max = mw;
+    maxPath = 'M';
 
-            //I
-            double mi = M[i][j-1] + tmi;
-            double ii = I[i][j-1] + tii;
+    if (ww>max)
+    {
+        max = ww;
+        maxPath = 'W';
+    }
 
-            max = mi;
-            maxPath = 'M';
+    cur[LW][j] = max;
+    if (TRACE) path[LW][j] = maxPath;
 
-            if (ii>max)
-            {
-                max = ii;
-                maxPath = 'I';
-            }
+    //Z
+    double mz = cur[LM][j-1] + tmz;
+    double wz = cur[LW][j-1] + twz;
+    double zz = cur[LZ][j-1] + tzz;
 
-            I[i][j] = max;
-            pathI[i][j] = maxPath;
+    max = mz;
+    maxPath = 'M';
 
-            //W
-            double mw = M[i-1][j] + tmw;
-            double ww = W[i-1][j] + tww;
+    if (wz>max)
+    {
+        max = wz;
+        maxPath = 'W';
+    }
+    if (zz>max)
+    {
+        max = zz;
+        maxPath = 'Z';
+    }
 
-            max = mw;
-            maxPath = 'M';
+    cur[LZ][j] = max;
+    if (TRACE) path[LZ][j] = maxPath;
+};
 
-            if (ww>max)
-            {
-                max = ww;
-                maxPath = 'W';
-            }
+/**
+ * Aligns a read against n probes and sets llks to the log odds of the best
+ * path against each.  Only the scores are computed, the path matrices are
+ * not touched and only row 0, two rolling rows and the rows at which probes
+ * branch off are kept, so memory is linear in the read length, see align for
+ * the traceback of a read.  The rows of the probe prefix that a probe shares
+ * with the previous one are not recomputed.  The probes are visited in
+ * lexicographic order, so the reference and alternative probes of a site,
+ * which share the preamble and left flank, and the probes of a multiallelic
+ * site are walked like a trie of their prefixes.
+ *
+ * The rows are not banded around the placement of the read.  The probes are
+ * shorter than the reads and the leading and trailing gaps of the read span
+ * whole rows, so a band saves little, and in a tandem repeat the best path
+ * of a read may lie wholly off a band without touching its edge.
+ */
+void LHMM::align_probes(const char** probes, uint32_t n, const char* _y, const char* _qual, double* llks)
+{
+    uint32_t len = strlen(_y);
+    set_quality_classes(_qual, len);
+    align_probes(probes, n, _y, len, _qual, qclasses, llks);
+};
+
+/**
+ * Aligns a read against n probes like align_probes, with the quality classes
+ * of the read computed by the caller, see quality_class.
+ */
+void LHMM::align_probes(const char** probes, uint32_t n, const char* _y, uint32_t _ylen, const char* _qual, const uint8_t* _qclasses, double* llks)
+{
+    y = _y;
+    qual = _qual;
+    ylen = _ylen;
+    qclasses = _qclasses;
+
+    set_probe_trie(probes, n);
 
-            W[i][j] = max;
-            pathW[i][j] = maxPath;
+    LHMMLanes lanes;
+    lanes.no_lanes = 1;
+    lanes.reads[0] = _y;
+    lanes.lens[0] = _ylen;
+    lanes.qclasses[0] = _qclasses;
+    lanes.llks[0] = llks;
+    lhmm_probes(*this, probes, lanes);
+
+    path.clear();
+};
+
+/**
+ * Aligns no_reads reads against n probes like align_probes, LHMM_BATCH_SIZE
+ * reads at a time in the lanes of vectors.  The reads are batched by length
+ * so that little of a batch is padding.  llks[r*n+k] is set to the log odds
+ * of read r against probe k, as align_probes gives them.
+ *
+ * If quantized is set, the reads of up to quantizedMaxLength bases without
+ * bases of quality classes with infinite emission log odds are aligned
+ * LHMM_QUANTIZED_BATCH_SIZE at a time with 16 bit scores in units of
+ * 1/LHMM_QUANTIZED_SCALE, see quantization_error_bound for how far their
+ * log odds may be from those of align_probes.  Returns the number of reads
+ * aligned with quantized scores.
+ */
+uint32_t LHMM::align_probes_batch(const char** probes, uint32_t n, uint32_t no_reads, const char* const* reads, const uint32_t* lens, const uint8_t* const* _qclasses, double* llks)
+{
+    set_probe_trie(probes, n);
+
+    batchOrder.resize(no_reads);
+    for (uint32_t r=0; r<no_reads; ++r)
+    {
+        batchOrder[r] = r;
+    }
+    std::stable_sort(batchOrder.begin(), batchOrder.end(), LHMMReadOrder(lens));
 
-            //Z
-            double mz = M[i][j-1] + tmz;
-            double wz = W[i][j-1] + twz;
-            double zz = Z[i][j-1] + tzz;
+    //reads that fit the quantized scores go first
+    uint32_t no_quantized = 0;
+    if (quantized)
+    {
+        for (uint32_t r=0; r<no_reads; ++r)
+        {
+            uint32_t read = batchOrder[r];
+            bool fits = lens[read]<=quantizedMaxLength;
+            for (uint32_t j=0; j<lens[read] && fits; ++j)
+            {
+                fits = _qclasses[read][j]!=0 && _qclasses[read][j]!=LHMM_NO_QUAL_CLASSES-1;
+            }
+            if (fits)
+            {
+                std::swap(batchOrder[r], batchOrder[no_quantized]);
+                ++no_quantized;
+            }
+        }
+        std::stable_sort(batchOrder.begin(), batchOrder.begin()+no_quantized, LHMMReadOrder(lens));
+        std::stable_sort(batchOrder.begin()+no_quantized, batchOrder.end(), LHMMReadOrder(lens));
+    }
 
-            max = mz;
-            maxPath = 'M';
+    LHMMLanes lanes;
+    for (uint32_t r=0; r<no_reads; r+=lanes.no_lanes)
+    {
+        uint32_t batch_size = r<no_quantized ? LHMM_QUANTIZED_BATCH_SIZE : LHMM_BATCH_SIZE;
+        lanes.no_lanes = std::min(batch_size, (r<no_quantized ? no_quantized : no_reads)-r);
+        for (uint32_t l=0; l<lanes.no_lanes; ++l)
+        {
+            uint32_t read = batchOrder[r+l];
+            lanes.reads[l] = reads[read];
+            lanes.lens[l] = lens[read];
+            lanes.qclasses[l] = _qclasses[read];
+            lanes.llks[l] = &llks[read*n];
+        }
 
-            if (wz>max)
+        if (r<no_quantized)
+        {
+#ifdef LHMM_X86
+            if (avx2)
             {
-                max = wz;
-                maxPath = 'W';
+                lhmm_probes_v16s_avx2(*this, probes, lanes);
             }
-            if (zz>max)
+            else
+#endif
             {
-                max = zz;
-                maxPath = 'Z';
+                lhmm_probes_v16s(*this, probes, lanes);
             }
+        }
+        else if (lanes.no_lanes==1)
+        {
+            lhmm_probes(*this, probes, lanes);
+        }
+#ifdef LHMM_X86
+        else if (avx2)
+        {
+            lhmm_probes_v4d_avx2(*this, probes, lanes);
+        }
+#endif
+        else
+        {
+            lhmm_probes_v4d(*this, probes, lanes);
+        }
+    }
+
+    path.clear();
+
+    return no_quantized;
+};
 
-            Z[i][j] = max;
-            pathZ[i][j] = maxPath;
+/**
+ * Returns the bound on the difference between the log odds of a read of
+ * ylen bases against a probe of xlen bases from align_probes_batch with
+ * quantized scores and from align_probes.  A path takes at most xlen+ylen
+ * transitions and ylen emissions, each off by at most half a unit when
+ * rounded, and the best path of either is at most this far from the best
+ * of the other.  Scores clamped at LHMM_QUANTIZED_FLOOR are not accounted
+ * for, they are far below the score of any best path.
+ */
+double LHMM::quantization_error_bound(uint32_t xlen, uint32_t ylen)
+{
+    return (xlen+2.0*ylen)*0.5/LHMM_QUANTIZED_SCALE;
+};
+
+/**
+ * Orders the probes lexicographically and finds the prefix each shares with
+ * the previous one, see align_probes.
+ */
+void LHMM::set_probe_trie(const char** probes, uint32_t n)
+{
+    probeOrder.resize(n);
+    for (uint32_t k=0; k<n; ++k)
+    {
+        probeOrder[k] = k;
+    }
+    std::sort(probeOrder.begin(), probeOrder.end(), LHMMProbeOrder(probes));
+
+    //a probe starts below the prefix it shares with the previous probe, the
+    //rows at these depths are kept along with row 0 and two rolling rows
+    probeStarts.assign(n, 0);
+    probeDepths.clear();
+    for (uint32_t k=1; k<n; ++k)
+    {
+        const char* a = probes[probeOrder[k-1]];
+        const char* b = probes[probeOrder[k]];
+        uint32_t shared = 0;
+        while (a[shared] && a[shared]==b[shared])
+        {
+            ++shared;
         }
+        probeStarts[k] = shared;
+        if (shared)
+        {
+            probeDepths.push_back(shared);
+        }
+    }
+    std::sort(probeDepths.begin(), probeDepths.end());
+    probeDepths.erase(std::unique(probeDepths.begin(), probeDepths.end()), probeDepths.end());
+};
+
+/**
+Align and compute genotype likelihood.
+*/
+void LHMM::align(double& llk, const char* _x, const char* _y, const char* _qual, bool debug)
+{
+    //std::cerr << "Running this\n" ;
+    x = _x;
+    y = _y;
+    qual = _qual;
+
+    //adds a starting character at the fron of each string that must be matched
+    xlen = strlen(x);
+    ylen = strlen(y);
+    set_quality_classes(qual, ylen);
+    initialize_matrices(xlen, ylen);
+
+    //std::cerr << "x: " << x << " " << xlen << "\n" ;
+    //std::cerr << "y: " << y << " " << ylen << "\n" ;
 
-        M[xlen][ylen] += logTau-logEta;
+    //construct possible solutions
+    double* prev[7];
+    double* cur[7];
+    char* paths[7];
+    for (uint32_t i=1; i<=xlen; ++i)
+    {
+        get_rows(i, prev, cur, paths);
+        for (uint32_t j=1; j<=ylen; ++j)
+        {
+            compute_cell<true>(prev, cur, paths, i, j);
+        }
     }
 
+    M[xlen][ylen] += logTau-logEta;
+
     if (debug)
     {
-        std::cerr << "\n=X=\n";
-        printVector(X, xlen+1, ylen+1);
-        std::cerr << "\n=Y=\n";
-        printVector(Y, xlen+1, ylen+1);
-        std::cerr << "\n=M=\n";
-        printVector(M, xlen+1, ylen+1);
-        std::cerr << "\n=D=\n";
-        printVector(D, xlen+1, ylen+1);
-        std::cerr << "\n=I=\n";
-        printVector(I, xlen+1, ylen+1);
-        std::cerr << "\n=W=\n";
-        printVector(W, xlen+1, ylen+1);
-        std::cerr << "\n=Z=\n";
-        printVector(Z, xlen+1, ylen+1);
-        std::cerr << "\n=Path X=\n";
-        printVector(pathX, xlen+1, ylen+1);
-        std::cerr << "\n=Path Y=\n";
-        printVector(pathY, xlen+1, ylen+1);
-        std::cerr << "\n=Path M=\n";
-        printVector(pathM, xlen+1, ylen+1);
-        std::cerr << "\n=Path D=\n";
-        printVector(pathD, xlen+1, ylen+1);
-        std::cerr << "\n=Path I=\n";
-        printVector(pathI, xlen+1, ylen+1);
-        std::cerr << "\n=Path W=\n";
-        printVector(pathW, xlen+1, ylen+1);
-        std::cerr << "\n=Path Z=\n";
-        printVector(pathZ, xlen+1, ylen+1);
+        print_matrices();
     }
 
     tracePath();
@@ -749,7 +1308,6 @@ void LHMM::computeLogLikelihood(double& llk, std::string& _path, const char* qua
     mismatchedBases = 0;
 
     llk = 0;
-    double q = 0;
     char lastState = 'S';
     uint32_t xIndex=0, yIndex=0;
     for (uint32_t i=0; i<_path.size(); ++i)
@@ -759,8 +1317,7 @@ void LHMM::computeLogLikelihood(double& llk, std::string& _path, const char* qua
 
         if (state=='M')
         {
-            q = pl2prob((uint32_t) qual[yIndex]-33);
-            llk = lt.log10prod(llk, logEmission(x[xIndex], y[yIndex], q));
+            llk = lt.log10prod(llk, log_emission(x[xIndex], y[yIndex], quality_class(qual[yIndex])));
             //compute for perfect fit
 
             if (x[xIndex]== y[yIndex])
@@ -855,7 +1412,7 @@ void LHMM::computeLogLikelihood(double& llk, double& perfectllk, std::string& _p
 
     llk = 0;
     perfectllk = 0;
-    double q = 0;
+    uint32_t qc = 0;
     char lastState = 'S';
     uint32_t xIndex=0, yIndex=0;
     for (uint32_t i=0; i<_path.size(); ++i)
@@ -866,10 +1423,9 @@ void LHMM::computeLogLikelihood(double& llk, double& perfectllk, std::string& _p
 
         if (state=='M')
         {
-            q = pl2prob((uint32_t) qual[yIndex]-33);
-            llk = lt.log10prod(llk, logEmission(x[xIndex], y[yIndex], q));
+            llk = lt.log10prod(llk, log_emission(x[xIndex], y[yIndex], quality_class(qual[yIndex])));
             //compute for perfect fit
-            perfectllk = lt.log10prod(perfectllk, logEmission(x[xIndex], x[xIndex], q));
+            perfectllk = lt.log10prod(perfectllk, log_emission(x[xIndex], x[xIndex], qc));
 
             if (x[xIndex]== y[yIndex])
             {
@@ -969,7 +1525,7 @@ void LHMM::computeLogLikelihood(double& llk, const char* qual)
 
         if (state=='M')
         {
-            llk = lt.log10prod(llk, logEmission(x[xIndex], y[yIndex], pl2prob((uint32_t) qual[yIndex-1]-33)));
+            llk = lt.log10prod(llk, log_emission(x[xIndex], y[yIndex], quality_class(qual[yIndex-1])));
             if (lastState=='M')
             {
                 llk = lt.log10prod(llk, tMM);
@@ -1104,7 +1660,7 @@ std::string LHMM::reverse(std::string s)
     return rs;
 };
 
-void LHMM::printVector(std::vector<std::vector<double> >& v, uint32_t xLen, uint32_t yLen)
+void LHMM::printVector(LHMMMatrix<double>& v, uint32_t xLen, uint32_t yLen)
 {
     for (uint32_t i=0; i<xLen; ++i)
     {
@@ -1117,7 +1673,7 @@ void LHMM::printVector(std::vector<std::vector<double> >& v, uint32_t xLen, uint
     }
 };
 
-void LHMM::printVector(std::vector<std::vector<char> >& v, uint32_t xLen, uint32_t yLen)
+void LHMM::printVector(LHMMMatrix<char>& v, uint32_t xLen, uint32_t yLen)
 {
     for (uint32_t i=0; i<xLen; ++i)
     {
@@ -1130,19 +1686,6 @@ void LHMM::printVector(std::vector<std::vector<char> >& v, uint32_t xLen, uint32
     }
 };
 
-void LHMM::printVector(std::vector<std::vector<double> >& v)
-{
-    for (uint32_t i=0; i<v.size(); ++i)
-    {
-        for (uint32_t j=0; j<v[i].size(); ++j)
-        {
-          std::cerr << v[i][j] << "\t";
-        }
-
-        std::cerr << "\n";
-    }
-};
-
 void LHMM::printAlignment(std::string& pad, std::stringstream& log)
 {
     std::stringstream xAligned;
@@ -27,6 +27,74 @@
 #include "utils.h"
 #include "log_tool.h"
 #include <regex.h>
+#include <algorithm>
+
+/**
+ * Number of quality classes in the emission tables, Q0 to Q93 followed by
+ * a class for Q94 and a class for the out of range qualities that pl2prob caps.
+ */
+#define LHMM_NO_QUAL_CLASSES 96
+
+/**
+ * Number of reads aligned at once in the lanes of a vector by align_probes_batch.
+ */
+#define LHMM_BATCH_SIZE 4
+
+/**
+ * Number of reads aligned at once with quantized scores, in the 16 bit
+ * lanes of vectors, by align_probes_batch.
+ */
+#define LHMM_QUANTIZED_BATCH_SIZE 16
+
+/**
+ * Units of a log10 of the quantized scores of align_probes_batch and the
+ * floor at which they are clamped, -128 in log10.
+ */
+#define LHMM_QUANTIZED_SCALE 128
+#define LHMM_QUANTIZED_FLOOR -16384
+
+/**
+ * Dynamic programming matrix stored contiguously by rows.
+ *
+ * The buffer is 64-byte aligned and rows are padded to a multiple
+ * of 64 bytes.  It grows on demand and is reused across alignments,
+ * cells are not initialized.
+ */
+template<class T>
+class LHMMMatrix
+{
+    public:
+    T* data;
+    uint32_t stride;
+    size_t capacity;
+
+    LHMMMatrix() : data(NULL), stride(0), capacity(0) {};
+
+    ~LHMMMatrix() { free(data); };
+
+    /**
+     * Sets the dimensions of the matrix, contents are not preserved.
+     */
+    void resize(uint32_t rows, uint32_t cols)
+    {
+        stride = (cols*sizeof(T)+63)/64*(64/sizeof(T));
+        if ((size_t)rows*stride>capacity)
+        {
+            free(data);
+            capacity = (size_t)rows*stride;
+            if (posix_memalign((void**)&data, 64, capacity*sizeof(T)))
+            {
+                fprintf(stderr, "[%s:%d %s] cannot allocate %zu bytes\n", __FILE__, __LINE__, __FUNCTION__, capacity*sizeof(T));
+                exit(1);
+            }
+        }
+    };
+
+    /**
+     * Returns row i.
+     */
+    T* operator[](uint32_t i) { return data + (size_t)i*stride; };
+};
 
 class LHMM
 {
@@ -35,23 +103,53 @@ class LHMM
     const char* y;
     const char* qual;
 
-    std::vector<std::vector<double> > X;
-    std::vector<std::vector<double> > Y;
-    std::vector<std::vector<double> > M;
-    std::vector<std::vector<double> > I;
-    std::vector<std::vector<double> > D;
-    std::vector<std::vector<double> > W;
-    std::vector<std::vector<double> > Z;
-    std::vector<std::vector<char> > pathX;
-    std::vector<std::vector<char> > pathY;
-    std::vector<std::vector<char> > pathM;
-    std::vector<std::vector<char> > pathD;
-    std::vector<std::vector<char> > pathI;
-    std::vector<std::vector<char> > pathW;
-    std::vector<std::vector<char> > pathZ;
+    LHMMMatrix<double> X;
+    LHMMMatrix<double> Y;
+    LHMMMatrix<double> M;
+    LHMMMatrix<double> I;
+    LHMMMatrix<double> D;
+    LHMMMatrix<double> W;
+    LHMMMatrix<double> Z;
+    LHMMMatrix<char> pathX;
+    LHMMMatrix<char> pathY;
+    LHMMMatrix<char> pathM;
+    LHMMMatrix<char> pathD;
+    LHMMMatrix<char> pathI;
+    LHMMMatrix<char> pathW;
+    LHMMMatrix<char> pathZ;
     std::vector<double> PLs;
 
-    uint32_t maxLength;
+    //probes of align_probes in lexicographic order, the depth below which each
+    //starts and the depths at which probes branch off, see set_probe_trie
+    std::vector<uint32_t> probeOrder;
+    std::vector<uint32_t> probeStarts;
+    std::vector<uint32_t> probeDepths;
+
+    //score rows, read bases and emissions of the probe kernel
+    LHMMMatrix<char> kernelBuffer;
+
+    //reads of align_probes_batch by length
+    std::vector<uint32_t> batchOrder;
+
+    //set if the CPU supports AVX2, align_probes_batch then uses AVX2 instructions
+    bool avx2;
+
+    //set to align the reads of align_probes_batch with quantized scores, the
+    //longest read whose scores fit in 16 bits
+    bool quantized;
+    uint32_t quantizedMaxLength;
+
+    //emission log odds and log probabilities indexed by quality class
+    double logMatchOdds[LHMM_NO_QUAL_CLASSES];
+    double logMismatchOdds[LHMM_NO_QUAL_CLASSES];
+    double logMatch[LHMM_NO_QUAL_CLASSES];
+    double logMismatch[LHMM_NO_QUAL_CLASSES];
+
+    //quality classes of the read being aligned, qclasses points to
+    //qualClasses or to classes computed by the caller
+    std::vector<uint8_t> qualClasses;
+    const uint8_t* qclasses;
+
     uint32_t xlen;
     uint32_t ylen;
     std::string path;
@@ -131,11 +229,56 @@ class LHMM
 
     bool containsIndel();
 
+    /**
+     * Sizes the matrices for aligning x and y and initializes their boundaries.
+     */
+    void initialize_matrices(uint32_t xlen, uint32_t ylen);
+
     /**
      * Convert PLs to probabilities.
      */
     double pl2prob(uint32_t PL);
 
+    /**
+     * Maps a phred+33 quality character to its class in the emission tables.
+     */
+    static inline uint32_t quality_class(char q)
+    {
+        uint32_t PL = (uint32_t) q-33;
+        return PL<LHMM_NO_QUAL_CLASSES-1 ? PL : LHMM_NO_QUAL_CLASSES-1;
+    };
+
+    /**
+     * Computes the quality classes of a read.
+     */
+    void set_quality_classes(const char* qual, uint32_t len);
+
+    /**
+     * Emission log odds for a base of quality class qc, N is a silent match.
+     */
+    inline double log_emission_odds(char readBase, char probeBase, uint32_t qc)
+    {
+        if (readBase=='N' || probeBase=='N')
+        {
+            return 0;
+        }
+
+        return readBase!=probeBase ? logMismatchOdds[qc] : logMatchOdds[qc];
+    };
+
+    /**
+     * Emission log probability for a base of quality class qc, N is a silent match.
+     */
+    inline double log_emission(char readBase, char probeBase, uint32_t qc)
+    {
+        if (readBase=='N' || probeBase=='N')
+        {
+            return 0;
+        }
+
+        return readBase!=probeBase ? logMismatch[qc] : logMatch[qc];
+    };
+
     /**
      * Updates matchStart, matchEnd, globalMaxPath and path
      * Updates locations of insertions and deletions
@@ -148,6 +291,56 @@ class LHMM
      */
     void align(double& llk, const char* _x, const char* _y, const char* qual, bool debug=false);
 
+    /**
+     * Aligns a read against n probes and sets llks to the log odds of the best path
+     * against each without the traceback, computing the rows of probe prefixes
+     * shared between probes once.  Use align for the path of a read.
+     */
+    void align_probes(const char** probes, uint32_t n, const char* _y, const char* qual, double* llks);
+
+    /**
+     * Aligns a read against n probes like align_probes, with the quality classes
+     * of the read computed by the caller, see quality_class.
+     */
+    void align_probes(const char** probes, uint32_t n, const char* _y, uint32_t _ylen, const char* qual, const uint8_t* _qclasses, double* llks);
+
+    /**
+     * Aligns no_reads reads against n probes like align_probes, LHMM_BATCH_SIZE
+     * reads at a time in the lanes of vectors, and sets llks[r*n+k] to the log
+     * odds of read r against probe k.  If quantized is set, the reads that fit
+     * are aligned with 16 bit scores, returns the number of these reads.
+     */
+    uint32_t align_probes_batch(const char** probes, uint32_t n, uint32_t no_reads, const char* const* reads, const uint32_t* lens, const uint8_t* const* _qclasses, double* llks);
+
+    /**
+     * Returns the bound on the difference between the log odds of a read of ylen
+     * bases against a probe of xlen bases with quantized scores and without.
+     */
+    static double quantization_error_bound(uint32_t xlen, uint32_t ylen);
+
+    /**
+     * Orders the probes lexicographically and finds the prefix each shares with
+     * the previous one, see align_probes.
+     */
+    void set_probe_trie(const char** probes, uint32_t n);
+
+    /**
+     * Gets rows i-1 and i of the score matrices and row i of the path matrices.
+     */
+    void get_rows(uint32_t i, double** prev, double** cur, char** path);
+
+    /**
+     * Computes the scores of all states for cell (i,j) from the rows i-1 and i
+     * of the states, and the paths if TRACE is set.
+     */
+    template<bool TRACE>
+    void compute_cell(double* const* prev, double* const* cur, char* const* path, uint32_t i, uint32_t j);
+
+    /**
+     * Prints the score and path matrices.
+     */
+    void print_matrices();
+
     //computes log likelihood based on path given in arguments
     void computeLogLikelihood(double& llk, double& perfectllk, std::string& _path, const char* qual);
 
@@ -174,11 +367,9 @@ class LHMM
 
     std::string reverse(std::string s);
 
-    void printVector(std::vector<std::vector<double> >& v, uint32_t xLen, uint32_t yLen);
-
-    void printVector(std::vector<std::vector<char> >& v, uint32_t xLen, uint32_t yLen);
+    void printVector(LHMMMatrix<double>& v, uint32_t xLen, uint32_t yLen);
 
-    void printVector(std::vector<std::vector<double> >& v);
+    void printVector(LHMMMatrix<char>& v, uint32_t xLen, uint32_t yLen);
 
     void printAlignment();
 
@@ -23,300 +23,766 @@
 
 #include "lhmm_genotyping_record.h"
 
-typedef struct
+namespace
 {
-  int32_t start1, end1;
-} interval_t;
-
-KHASH_MAP_INIT_STR(rdict, interval_t)
 
 /**
- * Maintains read information and allows for additional reads
- * till VCF record can be printed out.
+ * Log10 likelihoods of the genotypes RR, RA and AA given a read base of
+ * each phred quality that carries the reference or the alternative allele
+ * of a SNP, as add_llks would add them.
  */
-class LHMMGenotypingRecord : GenotypingRecord
+class SNPLikelihoods
 {
     public:
-    bcf1_t *v;
-    int32_t vtype;
-    uint32_t read_no;
-
-    khash_t(rdict) *reads;
-    khiter_t k;
-    int32_t ret;
-
-    char* ref_probe;
-    char* alt_probe;
-    uint32_t plen;
-
-    kstring_t rqs;
-    kstring_t aqs;
-
-    LHMMGenotypingRecord(bcf_hdr_t *h, bcf1_t *v)
-    {
-        reads = kh_init(rdict);
-        
-        this->v = v;
-        
-        ref_probe = (char*) malloc(1);
-        
-        int32_t len;
-        int32_t ret = bcf_get_info_string(h, v, "REFPROBE", &ref_probe, &len);
-        
-        std::cerr << ref_probe << " " << len << " " << ret << "\n";
-        bcf_print(h,v);
-        
-        
-        exit(1);
-        
-//        int32_t probeLength = strlen(refProbe);
-//        int32_t variantLengthDifference = (int32_t)strlen(alt)-(int32_t)strlen(ref);
-        
-    };
+    double gls[2][256][3];
+
+    SNPLikelihoods()
+    {
+        for (uint32_t q=0; q<256; ++q)
+        {
+            double e = pow(10, -((int32_t)q)/10.0);
+            for (uint32_t a=0; a<2; ++a)
+            {
+                double refllk = a==0 ? log10(1-e) : log10(e/3);
+                double altllk = a==0 ? log10(e/3) : log10(1-e);
+
+                //cap the evidence of a single read
+                if (refllk-altllk>LHMM_GENOTYPING_MAX_LLR)
+                {
+                    altllk = refllk-LHMM_GENOTYPING_MAX_LLR;
+                }
+                else if (altllk-refllk>LHMM_GENOTYPING_MAX_LLR)
+                {
+                    refllk = altllk-LHMM_GENOTYPING_MAX_LLR;
+                }
+
+                double maxllk = refllk>altllk ? refllk : altllk;
+                gls[a][q][0] = refllk;
+                gls[a][q][1] = maxllk + log10(0.5*(pow(10, refllk-maxllk)+pow(10, altllk-maxllk)));
+                gls[a][q][2] = altllk;
+            }
+        }
+    }
+};
+
+const SNPLikelihoods snp_likelihoods;
+
+/**
+ * FNV-1a hash of the sequence and quality classes of a read.  The bases
+ * outside the probes and the exact qualities are kept as they all change
+ * the alignment, collisions are resolved by comparing the reads.
+ */
+uint64_t hash_read(GenotypingRead *read)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (uint32_t i=0; i<read->seq.l; ++i)
+    {
+        h = (h ^ (uint8_t) read->seq.s[i]) * 1099511628211ULL;
+        h = (h ^ read->qclasses[i]) * 1099511628211ULL;
+    }
 
-    ~LHMMGenotypingRecord(){};
+    return h;
+}
 
-    /**
-     * Prints records
-     */
-    void genotype(bam1_t *b)
+/**
+ * Gets the 2 bit code of a base, -1 for ambiguous bases.
+ */
+inline int32_t base2code(char b)
+{
+    switch (b)
     {
-        if (vtype == VT_SNP)
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+/**
+ * Gets the sorted k-mers of a sequence, k-mers with ambiguous bases are skipped.
+ */
+void get_kmers(const char* seq, uint32_t k, std::vector<uint64_t>& kmers)
+{
+    kmers.clear();
+    uint64_t mask = k<32 ? (1ULL<<(2*k))-1 : ~0ULL;
+    uint64_t kmer = 0;
+    uint32_t len = 0;
+    for (const char* p=seq; *p; ++p)
+    {
+        int32_t c = base2code(*p);
+        if (c<0)
         {
-            //genotype SNP
+            len = 0;
+            continue;
         }
-        else if (vtype & VT_INDEL)
+
+        kmer = ((kmer<<2)|c) & mask;
+        if (++len>=k)
         {
-            //genotype Indel
+            kmers.push_back(kmer);
         }
     }
 
-    void genotype_indel(bam1_t* s)
+    std::sort(kmers.begin(), kmers.end());
+    kmers.erase(std::unique(kmers.begin(), kmers.end()), kmers.end());
+}
+
+/**
+ * Returns true if two reads have the same sequence and quality classes.
+ */
+bool same_read(GenotypingRead *a, GenotypingRead *b)
+{
+    return a->seq.l==b->seq.l &&
+           !memcmp(a->seq.s, b->seq.s, a->seq.l) &&
+           !memcmp(a->qclasses.data(), b->qclasses.data(), a->seq.l);
+}
+
+}
+
+/**
+ * Constructor.
+ */
+LHMMGenotypingRecord::LHMMGenotypingRecord(bcf_hdr_t *h, bcf1_t *v, uint32_t no_samples, ProbeCache *probe_cache)
+{
+    mates = kh_init(mates);
+    mate_names = {0,0,0};
+    no_stitched = 0;
+    llk_cache = kh_init(llkcache);
+    no_alignments = 0;
+    no_cached_alignments = 0;
+
+    kmer_size = 0;
+    kmer_min_qual = 0;
+    audit_prefilter = false;
+    prefilter_llrs[0] = prefilter_llrs[1] = 0;
+    no_prefiltered = 0;
+    no_prefilter_discordances = 0;
+
+    quantized = false;
+    audit_quantized = false;
+    no_quantized_alignments = 0;
+    no_quantization_violations = 0;
+    max_quantization_error = 0;
+
+    ref_probe = NULL;
+    alt_probe = NULL;
+    m_ref_probe = 0;
+    m_alt_probe = 0;
+    this->probe_cache = probe_cache;
+    probes_pending = false;
+
+    genotyped = false;
+    this->no_samples = no_samples;
+    read_no = 0;
+    depths.resize(no_samples, 0);
+    gls.resize(3*no_samples, 0);
+    gts.resize(2*no_samples);
+    pls.resize(3*no_samples);
+    dps.resize(no_samples);
+
+    set(h, v);
+};
+
+/**
+ * Destructor.
+ */
+LHMMGenotypingRecord::~LHMMGenotypingRecord()
+{
+    clear();
+    kh_destroy(mates, mates);
+    for (uint32_t i=0; i<stitched.size(); ++i)
+    {
+        delete stitched[i];
+    }
+    kh_destroy(llkcache, llk_cache);
+    if (m_ref_probe) free(ref_probe);
+    if (m_alt_probe) free(alt_probe);
+    if (mate_names.m) free(mate_names.s);
+};
+
+/**
+ * Sets a bcf record.
+ *
+ * Only biallelic SNPs and indels with probes, or a probe cache to
+ * get them from, are genotyped, other records are printed without genotypes.
+ */
+void LHMMGenotypingRecord::set(bcf_hdr_t *h, bcf1_t *v)
+{
+    GenotypingRecord::set(h, v);
+    bcf_unpack(v, BCF_UN_INFO);
+
+    vtype = VT_REF;
+    probes_pending = false;
+    if (bcf_get_n_allele(v)==2)
     {
-        //maximum depth cap
-        if (read_no>255)
+        size_t rlen = strlen(bcf_get_ref(v));
+        size_t alen = strlen(bcf_get_alt(v, 1));
+
+        if (rlen==1 && alen==1)
+        {
+            vtype = VT_SNP;
+        }
+        else if (rlen!=alen &&
+                 bcf_get_info_string(h, v, "REFPROBE", &ref_probe, &m_ref_probe)>0 &&
+                 bcf_get_info_string(h, v, "ALTPROBE", &alt_probe, &m_alt_probe)>0)
         {
+            vtype = VT_INDEL;
+        }
+        else if (rlen!=alen && probe_cache)
+        {
+            vtype = VT_INDEL;
+            probes_pending = true;
+        }
+    }
+};
+
+/**
+ * Gets the probes of an indel from the probe cache.
+ * Returns false if the probes are ill defined.
+ */
+bool LHMMGenotypingRecord::get_probes()
+{
+    std::string ref, alt;
+    if (!probe_cache->get_probes(bcf_get_chrom(h, v), pos1, bcf_get_ref(v), bcf_get_alt(v, 1), ref, alt))
+    {
+        return false;
+    }
+
+    if (m_ref_probe<(int32_t)ref.size()+1)
+    {
+        m_ref_probe = ref.size()+1;
+        ref_probe = (char*) realloc(ref_probe, m_ref_probe);
+    }
+    strcpy(ref_probe, ref.c_str());
+
+    if (m_alt_probe<(int32_t)alt.size()+1)
+    {
+        m_alt_probe = alt.size()+1;
+        alt_probe = (char*) realloc(alt_probe, m_alt_probe);
+    }
+    strcpy(alt_probe, alt.c_str());
+
+    return true;
+};
+
+/**
+ * Genotypes a read and add to body of evidence.  The read is expected
+ * to have passed GenotypingRead::is_genotypable, indel records hold on
+ * to it till compute() and count it in read->refs.
+ */
+void LHMMGenotypingRecord::genotype(GenotypingRead *read)
+{
+    if (vtype==VT_REF)
+    {
+        return;
+    }
+
+    //probes are only made for sites with reads
+    if (probes_pending)
+    {
+        probes_pending = false;
+        if (!get_probes())
+        {
+            vtype = VT_REF;
             return;
         }
+    }
+
+    int32_t sample_id = read->sample_id;
 
-        //has secondary alignment or fail QC or is duplicate or is unmapped
-        if (bam_get_flag(s) & 0x0704)
+    //maximum depth cap
+    if (depths[sample_id]>255)
+    {
+        return;
+    }
+
+    //this read is the first of the pair
+    if (read->mpos1 && (read->tid==read->mtid))
+    {
+        uint64_t key = read->name_hash;
+
+        //first mate
+        if (read->mpos1>read->pos1)
         {
+            //overlapping (only insert a paired end if you know it will overlap)
+            if (read->mpos1<=(read->pos1 + (int32_t) read->seq.l - 1))
+            {
+                k = kh_put(mates, mates, key, &ret);
+                if (ret)
+                {
+                    kh_val(mates, k).name = mate_names.l;
+                    kh_val(mates, k).read = vtype==VT_INDEL ? (int32_t) collected.size() : -1;
+                    kputsn(read->name.s, read->name.l+1, &mate_names);
+                }
+            }
+        }
+        else if ((k = kh_get(mates, mates, key))!=kh_end(mates) &&
+                 !strcmp(&mate_names.s[kh_val(mates, k).name], read->name.s))
+        {
+            int32_t i = kh_val(mates, k).read;
+            kh_del(mates, mates, k);
+
+            //stitch the overlapping mates of an indel, drop the second mate otherwise
+            if (i>=0)
+            {
+                if (no_stitched==stitched.size())
+                {
+                    stitched.push_back(new GenotypingRead());
+                }
+
+                if (stitched[no_stitched]->stitch(fragments[i], read))
+                {
+                    fragments[i] = stitched[no_stitched++];
+                }
+            }
+
             return;
         }
+    }
 
-        //ignore poor quality mappings
-        if (bam_get_mapq(s)<13)
+    if (vtype==VT_SNP)
+    {
+        const double* llks = genotype_snp(read);
+        if (!llks)
         {
             return;
         }
 
-        //this read is the first of the pair
-        if (bam_get_mpos1(s) && (bam_get_tid(s)==bam_get_mtid(s)))
+        double* gl = &gls[3*sample_id];
+        gl[0] += llks[0];
+        gl[1] += llks[1];
+        gl[2] += llks[2];
+    }
+    else
+    {
+        collected.push_back(read);
+        fragments.push_back(read);
+        ++read->refs;
+    }
+
+    ++depths[sample_id];
+    ++read_no;
+};
+
+/**
+ * Adds the log10 likelihoods of a read given the reference and alternative allele to gls.
+ */
+void LHMMGenotypingRecord::add_llks(int32_t sample_id, double refllk, double altllk)
+{
+    //cap the evidence of a single read
+    if (refllk-altllk>LHMM_GENOTYPING_MAX_LLR)
+    {
+        altllk = refllk-LHMM_GENOTYPING_MAX_LLR;
+    }
+    else if (altllk-refllk>LHMM_GENOTYPING_MAX_LLR)
+    {
+        refllk = altllk-LHMM_GENOTYPING_MAX_LLR;
+    }
+
+    double maxllk = refllk>altllk ? refllk : altllk;
+    double* gl = &gls[3*sample_id];
+    gl[0] += refllk;
+    gl[1] += maxllk + log10(0.5*(pow(10, refllk-maxllk)+pow(10, altllk-maxllk)));
+    gl[2] += altllk;
+};
+
+/**
+ * Gets the log10 likelihoods of the genotypes RR, RA and AA of a SNP given a read.
+ * Returns NULL if the read carries neither allele.
+ */
+const double* LHMMGenotypingRecord::genotype_snp(GenotypingRead *read)
+{
+    int32_t rpos = read->get_rpos(pos1);
+
+    if (rpos==BAM_READ_INDEX_NA)
+    {
+        return NULL;
+    }
+
+    char base = read->seq.s[rpos];
+    uint8_t qual = read->qual.s[rpos]-33;
+
+    if (base==bcf_get_snp_ref(v))
+    {
+        return snp_likelihoods.gls[0][qual];
+    }
+    else if (base==bcf_get_snp_alt(v))
+    {
+        return snp_likelihoods.gls[1][qual];
+    }
+
+    return NULL;
+};
+
+/**
+ * Sets the k-mer prefilter, k of 0 disables it.  k-mers with a base below
+ * min_qual are ignored.  If audit is true, prefiltered reads are aligned
+ * anyway and disagreements with the alignment are counted and reported.
+ */
+void LHMMGenotypingRecord::set_prefilter(uint32_t k, uint32_t min_qual, bool audit)
+{
+    if (k>32)
+    {
+        fprintf(stderr, "[E:%s:%d %s] k-mer size %d larger than 32\n", __FILE__, __LINE__, __FUNCTION__, k);
+        exit(1);
+    }
+
+    kmer_size = k;
+    kmer_min_qual = min_qual;
+    audit_prefilter = audit;
+};
+
+/**
+ * Sets the alignment of reads with quantized scores.  If audit is true, the
+ * reads are aligned without too and the differences are recorded.
+ */
+void LHMMGenotypingRecord::set_quantized(bool quantized, bool audit)
+{
+    this->quantized = quantized;
+    audit_quantized = audit;
+};
+
+/**
+ * Builds the sets of k-mers specific to each probe.
+ */
+void LHMMGenotypingRecord::set_allele_kmers()
+{
+    std::vector<uint64_t> ref, alt;
+    get_kmers(ref_probe, kmer_size, ref);
+    get_kmers(alt_probe, kmer_size, alt);
+
+    ref_kmers.clear();
+    alt_kmers.clear();
+    std::set_difference(ref.begin(), ref.end(), alt.begin(), alt.end(), std::back_inserter(ref_kmers));
+    std::set_difference(alt.begin(), alt.end(), ref.begin(), ref.end(), std::back_inserter(alt_kmers));
+};
+
+/**
+ * Classifies the reads by their allele specific k-mers into alleles and
+ * sets the log likelihood ratios given to the prefiltered reads.
+ *
+ * The evidence of a read that spans an allele depends mostly on how far
+ * it runs into the flanks, in a tandem repeat reaching past the probes a
+ * read may even fit the other allele better.  So the reads of an allele
+ * that start leftmost and end rightmost are aligned as exemplars and
+ * marked with -1 in alleles.  If their log likelihood ratios are positive
+ * and agree within LHMM_GENOTYPING_PREFILTER_TOLERANCE, the other reads of
+ * the allele are given the least of them, otherwise they are aligned.
+ */
+void LHMMGenotypingRecord::classify_reads(LHMM *lhmm)
+{
+    int32_t exemplars[2][2] = {{-1, -1}, {-1, -1}};
+    for (uint32_t i=0; i<fragments.size(); ++i)
+    {
+        GenotypingRead *read = fragments[i];
+        if (!(alleles[i] = prefilter(read)))
+        {
+            continue;
+        }
+
+        int32_t* e = exemplars[alleles[i]-1];
+        if (e[0]<0 || read->pos1<fragments[e[0]]->pos1) e[0] = i;
+        if (e[1]<0 || read->end1>fragments[e[1]]->end1) e[1] = i;
+    }
+
+    //the exemplars of both alleles are aligned in one batch
+    batch.clear();
+    for (uint32_t a=0; a<2; ++a)
+    {
+        for (uint32_t e=0; e<2; ++e)
+        {
+            int32_t i = exemplars[a][e];
+            if (i>=0 && alleles[i]>0)
+            {
+                batch.push_back(i);
+                alleles[i] = -1;
+            }
+        }
+    }
+    align_reads(lhmm);
+
+    for (uint32_t a=0; a<2; ++a)
+    {
+        prefilter_llrs[a] = 0;
+        if (exemplars[a][0]<0)
+        {
+            continue;
+        }
+
+        double min_llr = LHMM_GENOTYPING_MAX_LLR;
+        double max_llr = -LHMM_GENOTYPING_MAX_LLR;
+        for (uint32_t e=0; e<2; ++e)
+        {
+            double *llks = &read_llks[2*exemplars[a][e]];
+            double llr = std::min(a ? llks[1]-llks[0] : llks[0]-llks[1], LHMM_GENOTYPING_MAX_LLR);
+            min_llr = std::min(min_llr, llr);
+            max_llr = std::max(max_llr, llr);
+        }
+
+        if (min_llr>0 && max_llr-min_llr<=LHMM_GENOTYPING_PREFILTER_TOLERANCE)
+        {
+            prefilter_llrs[a] = min_llr;
+        }
+    }
+};
+
+/**
+ * Aligns the reads in batch against the probes and sets their log likelihoods in read_llks.
+ */
+void LHMMGenotypingRecord::align_reads(LHMM *lhmm)
+{
+    const char* probes[2] = {ref_probe, alt_probe};
+    batch_seqs.resize(batch.size());
+    batch_lens.resize(batch.size());
+    batch_qclasses.resize(batch.size());
+    batch_llks.resize(2*batch.size());
+    for (uint32_t b=0; b<batch.size(); ++b)
+    {
+        GenotypingRead *read = fragments[batch[b]];
+        batch_seqs[b] = read->seq.s;
+        batch_lens[b] = read->seq.l;
+        batch_qclasses[b] = read->qclasses.data();
+    }
+
+    lhmm->quantized = quantized;
+    no_quantized_alignments += lhmm->align_probes_batch(probes, 2, batch.size(), batch_seqs.data(), batch_lens.data(), batch_qclasses.data(), batch_llks.data());
+    no_alignments += batch.size();
+
+    if (quantized && audit_quantized)
+    {
+        lhmm->quantized = false;
+        audit_llks.resize(2*batch.size());
+        lhmm->align_probes_batch(probes, 2, batch.size(), batch_seqs.data(), batch_lens.data(), batch_qclasses.data(), audit_llks.data());
+        for (uint32_t b=0; b<2*batch.size(); ++b)
         {
-            //first mate 
-            if (bam_get_mpos1(s)>bam_get_pos1(s))
+            double error = fabs(batch_llks[b]-audit_llks[b]);
+            max_quantization_error = std::max(max_quantization_error, error);
+            if (error>LHMM::quantization_error_bound(strlen(probes[b%2]), batch_lens[b/2]))
             {
-                //overlapping (only insert a paired end if you know it will overlap)
-                if (bam_get_mpos1(s)<=(bam_get_pos1(s) + bam_get_l_qseq(s) - 1))
+                ++no_quantization_violations;
+                fprintf(stderr, "quantization: %s:%d %s log10 likelihood against %s %f, without quantization %f\n",
+                        bcf_get_chrom(h, v), pos1, fragments[batch[b/2]]->name.s, b%2 ? "ALT" : "REF", batch_llks[b], audit_llks[b]);
+            }
+        }
+    }
+
+    for (uint32_t b=0; b<batch.size(); ++b)
+    {
+        read_llks[2*batch[b]] = batch_llks[2*b];
+        read_llks[2*batch[b]+1] = batch_llks[2*b+1];
+    }
+};
+
+/**
+ * Classifies a read by its allele specific k-mers, a read that has all the
+ * k-mers specific to one allele and none of the other is classified.
+ * Returns 1 for the reference, 2 for the alternative allele and 0 otherwise.
+ */
+int32_t LHMMGenotypingRecord::prefilter(GenotypingRead *read)
+{
+    ref_kmer_hits.assign(ref_kmers.size(), 0);
+    alt_kmer_hits.assign(alt_kmers.size(), 0);
+    uint32_t ref_hits = 0, alt_hits = 0;
+    uint64_t mask = kmer_size<32 ? (1ULL<<(2*kmer_size))-1 : ~0ULL;
+    uint64_t kmer = 0;
+    uint32_t len = 0;
+    int32_t last_low_qual = -1; //index of the last base below kmer_min_qual
+    for (uint32_t i=0; i<read->seq.l; ++i)
+    {
+        int32_t c = base2code(read->seq.s[i]);
+        if (c<0)
+        {
+            len = 0;
+            continue;
+        }
+
+        if ((uint32_t)(read->qual.s[i]-33)<kmer_min_qual)
+        {
+            last_low_qual = i;
+        }
+
+        kmer = ((kmer<<2)|c) & mask;
+        if (++len>=kmer_size && (int32_t)(i-kmer_size)>=last_low_qual)
+        {
+            //distinct k-mers are counted, a k-mer may occur more than once in a read
+            std::vector<uint64_t>::iterator r = std::lower_bound(ref_kmers.begin(), ref_kmers.end(), kmer);
+            if (r!=ref_kmers.end() && *r==kmer && !ref_kmer_hits[r-ref_kmers.begin()])
+            {
+                ref_kmer_hits[r-ref_kmers.begin()] = 1;
+                ++ref_hits;
+            }
+            std::vector<uint64_t>::iterator a = std::lower_bound(alt_kmers.begin(), alt_kmers.end(), kmer);
+            if (a!=alt_kmers.end() && *a==kmer && !alt_kmer_hits[a-alt_kmers.begin()])
+            {
+                alt_kmer_hits[a-alt_kmers.begin()] = 1;
+                ++alt_hits;
+            }
+        }
+    }
+
+    if (ref_hits && ref_hits==ref_kmers.size() && !alt_hits) return 1;
+    if (alt_hits && alt_hits==alt_kmers.size() && !ref_hits) return 2;
+    return 0;
+};
+
+/**
+ * Aligns the reads collected for an indel and adds them to the body of evidence.
+ */
+void LHMMGenotypingRecord::compute(LHMM *lhmm)
+{
+    read_llks.resize(2*fragments.size());
+
+    alleles.assign(fragments.size(), 0);
+    if (kmer_size && fragments.size())
+    {
+        set_allele_kmers();
+        classify_reads(lhmm);
+    }
+
+    //reads identical to an earlier read reuse its alignment, the others are aligned in one batch
+    sources.assign(fragments.size(), -1);
+    batch.clear();
+    for (uint32_t i=0; i<fragments.size(); ++i)
+    {
+        GenotypingRead *read = fragments[i];
+
+        //exemplars were aligned by classify_reads
+        if (alleles[i]<0)
+        {
+            continue;
+        }
+
+        int32_t ret;
+        khiter_t k = kh_put(llkcache, llk_cache, hash_read(read), &ret);
+        if (!ret)
+        {
+            uint32_t j = kh_val(llk_cache, k);
+            if (same_read(read, fragments[j]))
+            {
+                sources[i] = j;
+                continue;
+            }
+        }
+        else
+        {
+            kh_val(llk_cache, k) = i;
+        }
+
+        if (alleles[i] && !prefilter_llrs[alleles[i]-1])
+        {
+            alleles[i] = 0;
+        }
+
+        if (!alleles[i] || audit_prefilter)
+        {
+            batch.push_back(i);
+        }
+    }
+    align_reads(lhmm);
+
+    for (uint32_t i=0; i<fragments.size(); ++i)
+    {
+        GenotypingRead *read = fragments[i];
+        double *llks = &read_llks[2*i];
+        int32_t allele = alleles[i];
+
+        //reuse the alignment of an identical read
+        if (sources[i]>=0)
+        {
+            llks[0] = read_llks[2*sources[i]];
+            llks[1] = read_llks[2*sources[i]+1];
+            ++no_cached_alignments;
+        }
+        else if (allele>0)
+        {
+            if (audit_prefilter)
+            {
+                //the prefilter agrees if the alignment gives about as much evidence for the allele or more
+                double llr = allele==1 ? llks[0]-llks[1] : llks[1]-llks[0];
+                if (std::min(llr, LHMM_GENOTYPING_MAX_LLR)<prefilter_llrs[allele-1]-LHMM_GENOTYPING_PREFILTER_TOLERANCE)
                 {
-                    //add read that has overlapping
-                    //duplicate the record and perform the stitching later
-                    char* qname = strdup(bam_get_qname(s));
-                    k = kh_put(rdict, reads, qname, &ret);
-                    if (!ret)
-                    {
-                        //already present
-                        free(qname);
-                    }
-                    kh_val(reads, k) = {bam_get_pos1(s), bam_get_pos1(s)+bam_get_l_qseq(s)-1};
+                    ++no_prefilter_discordances;
+                    fprintf(stderr, "prefilter: %s:%d %s classified as %s with log10 likelihood ratio %f, alignment log10 likelihood ratio %f\n",
+                            bcf_get_chrom(h, v), pos1, read->name.s, allele==1 ? "REF" : "ALT", prefilter_llrs[allele-1], llr);
                 }
             }
-            else
+
+            llks[0] = allele==1 ? 0 : -prefilter_llrs[1];
+            llks[1] = allele==2 ? 0 : -prefilter_llrs[0];
+            ++no_prefiltered;
+        }
+
+        add_llks(read->sample_id, llks[0], llks[1]);
+    }
+};
+
+/**
+ * Prints record with GT, PL and DP.
+ */
+void LHMMGenotypingRecord::print(BCFOrderedWriter *odw)
+{
+    if (no_samples && (uint32_t) bcf_hdr_nsamples(odw->hdr)==no_samples)
+    {
+        for (uint32_t j=0; j<no_samples; ++j)
+        {
+            gts[2*j] = gts[2*j+1] = bcf_gt_missing;
+            pls[3*j] = pls[3*j+1] = pls[3*j+2] = bcf_int32_missing;
+            dps[j] = depths[j];
+
+            if (depths[j])
             {
-                //check overlap
-                //todo: perform stitching in future
-                if((k = kh_get(rdict, reads, bam_get_qname(s)))!=kh_end(reads))
+                double* gl = &gls[3*j];
+                uint32_t best = 0;
+                for (uint32_t i=1; i<3; ++i)
+                {
+                    if (gl[i]>gl[best]) best = i;
+                }
+
+                for (uint32_t i=0; i<3; ++i)
                 {
-                    if (kh_exist(reads, k))
-                    {
-                        free((char*)kh_key(reads, k));
-                        kh_del(rdict, reads, k);
-                    }
+                    double pl = -10*(gl[i]-gl[best]);
+                    pls[3*j+i] = pl>INT16_MAX ? INT16_MAX : (int32_t) round(pl);
                 }
-                return; // for the time being, just drop this read.
+
+                int32_t a1 = best==2 ? 1 : 0;
+                int32_t a2 = best==0 ? 0 : 1;
+                gts[2*j] = bcf_gt_unphased(a1);
+                gts[2*j+1] = bcf_gt_unphased(a2);
             }
         }
 
-//        //read name
-//
-//        //sequence
-//        readseq.l=0;
-//        bam_get_seq_string(s, &readseq);
-//
-//        //qual
-//        bam_get_qual_string(s, &readqual, readseq.s);
-//
-//        //map qual
-//        uint32_t mapQual = bam_get_mapq(s);
-//
-//        std::string refCigar = "";
-//        std::string altCigar = "";
-//
-//        double refllk = 0, altllk = 0;
-//
-//        lhmm_ref.align(refllk, refProbe, readseq.s, readqual.s);
-//        lhmm_ref.computeLogLikelihood(refllk, lhmm_ref.getPath(), readqual.s);
-//
-//        lhmm_alt.align(altllk, altProbe, readseq.s, readqual.s);
-//        lhmm_alt.computeLogLikelihood(altllk, lhmm_alt.getPath(), readqual.s);
-//
-//        std::string pad = "\t";
-//        if (debug)
-//        {
-//            prec.log << pad << "==================\n";
-//            prec.log << pad <<  (prec.read_no+1) << ") " << chrom << ":" << (pos0+1) << ":" << ref << ":" << alt << ":" << variantLengthDifference << "\n";
-//            prec.log << pad <<  read_name << "\n";
-//            prec.log << pad << "==================\n";
-//            prec.log << pad << "ref probe     " << refProbe << " (" << plen << "/" << probeLength << ")\n";
-//            prec.log << pad << "read sequence " << readseq.s  << "\n";
-//            prec.log << pad << "==================\n";
-//            lhmm_ref.printAlignment(pad, prec.log);
-//            prec.log << pad << "ref llk: " << refllk << "\n";
-//            prec.log << pad << "expected indel location: " << plen+1 << "\n";
-//            prec.log << pad << "==================\n";
-//            prec.log << pad << "==================\n";
-//            prec.log << pad << "alt probe     " << altProbe << " (" << plen << ")\n";
-//            prec.log << pad << "read sequence " << readseq.s  << "\n";
-//            prec.log << pad << "==================\n";
-//            lhmm_alt.printAlignment(pad, prec.log);
-//            prec.log << pad << "alt llk: " << altllk << "\n";
-//            prec.log << pad << "expected indel location: " << plen+1 << "\n";
-//            prec.log << pad << "==================\n\n";
-//        }
-//
-//        //check if the Insertions and Deletions are at the expected places.
-//        //deletion
-//        uint32_t ref_rpos=0, alt_rpos=0;
-//        if (variantLengthDifference<0)
-//        {
-//            //deletion
-//            if (!deletion_start_exists(lhmm_ref, plen+1, ref_rpos) &&
-//                 insertion_start_exists(lhmm_alt, plen+1, alt_rpos))
-//            {
-//                if (refllk<altllk)
-//                {
-//                    swap(refllk, altllk);
-//                }
-//
-//                //ref allele
-//                if (debug)
-//                    std::cerr << pad << "DEL: REF ALLELE\n";
-//            }
-//            else if (deletion_start_exists(lhmm_ref, plen+1, ref_rpos) &&
-//                    !insertion_start_exists(lhmm_alt, plen+1, alt_rpos))
-//            {
-//                if (refllk>altllk)
-//                {
-//                    swap(refllk, altllk);
-//                }
-//
-//                //alt allele
-//                if (debug)
-//                    std::cerr << pad << "DEL: ALT ALLELE\n";
-//            }
-//            else
-//            {
-//                refllk = 0;
-//                altllk = 0;
-//                if (debug)
-//                    std::cerr << pad << "Deletion not at expected location, set as ambiguous\n";
-//            }
-//        }
-//        else if (variantLengthDifference>0)
-//        {
-//            //insertion
-//            if (!insertion_start_exists(lhmm_ref, plen+1, ref_rpos) &&
-//                 deletion_start_exists(lhmm_alt, plen+1, alt_rpos))
-//            {
-//                if (refllk<altllk)
-//                {
-//                    swap(refllk, altllk);
-//                }
-//
-//                //ref allele
-//                if (debug)
-//                    std::cerr << pad << "INS: REF ALLELE\n";
-//            }
-//            else if (insertion_start_exists(lhmm_ref, plen+1, ref_rpos) &&
-//                    !deletion_start_exists(lhmm_alt, plen+1, alt_rpos))
-//            {
-//                if (refllk>altllk)
-//                {
-//                    swap(refllk, altllk);
-//                }
-//
-//                //alt allele
-//                if (debug)
-//                    std::cerr << pad << "INS: ALT ALLELE\n";
-//            }
-//            else
-//            {
-//                refllk = 0;
-//                altllk = 0;
-//                if (debug)
-//                    std::cerr << pad << "Insertion not at expected location "  << plen+1 << ", set as ambiguous\n";
-//            }
-//        }
-//
-//        if (debug)
-//        {
-//          std::cerr << pad << "++++++++++++++++++\n";
-//            std::cerr << pad << "reflk " << refllk << "\n";
-//          std::cerr << pad << "altlk " << altllk << "\n";
-//        }
-//
-//        uint32_t baseqr = 0, baseqa = 0;
-//        //char allele = 'N';
-//        uint32_t rpos = 0;
-//        if (refllk>altllk)
-//        {
-//          //allele = 'R';
-//            rpos = alt_rpos;
-//            baseqa = round(-10*(altllk-refllk));
-//        }
-//        else if (refllk<altllk)
-//        {
-//          //allele = 'A';
-//              rpos = ref_rpos;
-//              baseqr = round(-10*(refllk-altllk));
-//        }
-//
-//        prec.rqs << (uint8_t)(baseqr>93? 126 : baseqr+33);
-//        prec.aqs << (uint8_t)(baseqa>93? 126 : baseqa+33);
-//        prec.mqs << (uint8_t)(mapQual>93? 126 : mapQual+33);
-//        int32_t tp =  pack_tp(!bam_is_rev(s), bam_is_fread1(s), rpos, bam_get_l_qseq(s));
-//        prec.tps << std::hex << (tp<16?"0":"") << tp << std::dec ;
-//
-//        ++prec.read_no;
-//
-//        free(refProbe);
-//        free(altProbe);
-//        free(plenstring);
-    }
-
-    /**
-     * Prints records
-     */
-    void print(BCFOrderedWriter *odw)
-    {
-
-    }
-
-    /**
-     * Prints records
-     */
-    void clear()
-    {
-    }
-};
\ No newline at end of file
+        bcf_update_genotypes(odw->hdr, v, gts.data(), 2*no_samples);
+        bcf_update_format_int32(odw->hdr, v, "PL", pls.data(), 3*no_samples);
+        bcf_update_format_int32(odw->hdr, v, "DP", dps.data(), no_samples);
+    }
+
+    GenotypingRecord::print(odw);
+};
+
+/**
+ * Clears this record.
+ */
+void LHMMGenotypingRecord::clear()
+{
+    GenotypingRecord::clear();
+
+    vtype = VT_REF;
+    genotyped = false;
+    read_no = 0;
+    std::fill(depths.begin(), depths.end(), 0);
+    std::fill(gls.begin(), gls.end(), 0);
+    collected.clear();
+    fragments.clear();
+    no_stitched = 0;
+    kh_clear(llkcache, llk_cache);
+    no_alignments = 0;
+    no_cached_alignments = 0;
+    no_prefiltered = 0;
+    no_prefilter_discordances = 0;
+    no_quantized_alignments = 0;
+    no_quantization_violations = 0;
+    max_quantization_error = 0;
+    kh_clear(mates, mates);
+    mate_names.l = 0;
+};
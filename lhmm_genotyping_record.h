@@ -40,5 +40,226 @@
 #include "bcf_ordered_writer.h"
 #include "variant_manip.h"
 #include "genotyping_record.h"
+#include "probe_cache.h"
+
+/**
+ * A first mate that overlaps its mate, by the offset of its name in
+ * the name arena and its index in the collected reads, -1 if not collected.
+ */
+typedef struct
+{
+  uint32_t name;
+  int32_t read;
+} mate_t;
+
+//cap on the log10 likelihood ratio between the alleles from a single read, a phred score of 93
+#define LHMM_GENOTYPING_MAX_LLR 9.3
+
+//spread of the log10 likelihood ratios of the exemplars of an allele within which its other
+//reads are prefiltered, and the shortfall of the alignment of a prefiltered read below the
+//ratio it was given that counts as a discordance in the audit
+#define LHMM_GENOTYPING_PREFILTER_TOLERANCE 0.5
+
+//fraction of discordant prefiltered reads in the audit above which the prefilter is reported as unreliable
+#define LHMM_GENOTYPING_PREFILTER_MAX_DISCORDANCE 0.01
+
+KHASH_MAP_INIT_INT64(mates, mate_t)
+KHASH_MAP_INIT_INT64(llkcache, uint32_t)
+
+/**
+ * Maintains read information and allows for additional reads
+ * till VCF record can be printed out.
+ *
+ * SNPs are genotyped from the base observed at the variant position
+ * as the reads are added, without alignment.  For indels, the reads are collected and
+ * aligned against the REFPROBE and ALTPROBE probes from construct_probes
+ * in compute(), which may run on another thread with its own LHMM
+ * once all the reads are in.  Without these tags, the probes are taken
+ * from the probe cache when the first read arrives, so that sites without
+ * reads are never probed.
+ *
+ * A read whose mate overlaps it is aligned once for the fragment.  For
+ * indels the mates are stitched into a consensus read, if they cannot be,
+ * or for SNPs, the second mate is dropped.
+ *
+ * Evidence is kept for each sample, the probes and the alignment
+ * of the reads of all the samples are shared by one record.
+ *
+ * Reads with the same sequence and quality classes at a site have the
+ * same alignments, these are aligned once and the log likelihoods reused.
+ * The whole read is keyed with exact quality classes as every base and
+ * quality enters its alignment, so hits are mostly duplicates that share
+ * binned qualities, and there are next to none with unbinned qualities.
+ *
+ * With the k-mer prefilter, a read that has all the k-mers found only in
+ * the REFPROBE or all found only in the ALTPROBE, and none of the other,
+ * spans that allele with at least k-1 matching bases on both flanks.  The
+ * leftmost and rightmost of these reads of an allele at a site are aligned,
+ * and if they agree, the others are taken to support the allele with the
+ * lesser evidence of the two without being aligned, see classify_reads.
+ * Other reads are aligned.
+ */
+class LHMMGenotypingRecord : public GenotypingRecord
+{
+    public:
+    int32_t vtype;
+    uint32_t no_samples;
+    uint32_t read_no;
+    std::vector<uint32_t> depths; //reads genotyped for each sample
+
+    //first mates overlapping their mates at this site, names are kept in an arena reset by clear()
+    khash_t(mates) *mates;
+    kstring_t mate_names;
+    khiter_t k;
+    int32_t ret;
+
+    char* ref_probe;
+    char* alt_probe;
+    int32_t m_ref_probe;
+    int32_t m_alt_probe;
+
+    //generates the probes of indels without REFPROBE and ALTPROBE, may be NULL
+    ProbeCache *probe_cache;
+    bool probes_pending;
+
+    //reads collected for an indel, released by the owner of the reads after printing
+    std::vector<GenotypingRead*> collected;
+
+    //reads aligned in compute(), the collected reads with first mates replaced by stitched mates
+    std::vector<GenotypingRead*> fragments;
+    std::vector<GenotypingRead*> stitched; //owned by this record and reused from site to site
+    uint32_t no_stitched;
+
+    //alignments of collected reads keyed by a hash of their sequence and quality classes
+    khash_t(llkcache) *llk_cache;
+    std::vector<double> read_llks;
+    std::vector<int32_t> sources; //index of the identical earlier read of each read, -1 if none
+    uint32_t no_alignments;
+    uint32_t no_cached_alignments;
+
+    //k-mer prefilter, disabled when kmer_size is 0
+    uint32_t kmer_size;
+    uint32_t kmer_min_qual;
+    bool audit_prefilter;
+    std::vector<uint64_t> ref_kmers; //k-mers found only in the REFPROBE, sorted
+    std::vector<uint64_t> alt_kmers; //k-mers found only in the ALTPROBE, sorted
+    std::vector<uint8_t> ref_kmer_hits; //k-mers of ref_kmers found in the read being classified
+    std::vector<uint8_t> alt_kmer_hits; //k-mers of alt_kmers found in the read being classified
+    std::vector<int32_t> alleles; //allele of each read aligned in compute(), see classify_reads
+    double prefilter_llrs[2]; //log10 likelihood ratio given to the prefiltered reads of each allele, 0 if none are
+    uint32_t no_prefiltered;
+    uint32_t no_prefilter_discordances;
+
+    //indices in fragments of the reads aligned together, see align_reads
+    std::vector<uint32_t> batch;
+    std::vector<const char*> batch_seqs;
+    std::vector<uint32_t> batch_lens;
+    std::vector<const uint8_t*> batch_qclasses;
+    std::vector<double> batch_llks;
+
+    //alignment with quantized scores, see LHMM::align_probes_batch, audited against
+    //the alignment without if audit_quantized is set
+    bool quantized;
+    bool audit_quantized;
+    std::vector<double> audit_llks;
+    uint32_t no_quantized_alignments;
+    uint32_t no_quantization_violations; //log likelihoods off by more than LHMM::quantization_error_bound
+    double max_quantization_error;
+
+    //set when compute() is done
+    bool genotyped;
+
+    //log10 likelihoods of the genotypes RR, RA and AA of each sample
+    std::vector<double> gls;
+
+    //GT, PL and DP of each sample written out by print()
+    std::vector<int32_t> gts;
+    std::vector<int32_t> pls;
+    std::vector<int32_t> dps;
+
+    LHMMGenotypingRecord(bcf_hdr_t *h, bcf1_t *v, uint32_t no_samples=1, ProbeCache *probe_cache=NULL);
+
+    ~LHMMGenotypingRecord();
+
+    /**
+     * Sets a bcf record.
+     */
+    void set(bcf_hdr_t *h, bcf1_t *v);
+
+    /**
+     * Genotypes a read and add to body of evidence.
+     */
+    void genotype(GenotypingRead *read);
+
+    /**
+     * Sets the k-mer prefilter, k of 0 disables it.  k-mers with a base below
+     * min_qual are ignored.  If audit is true, prefiltered reads are aligned
+     * anyway and disagreements with the alignment are counted and reported.
+     */
+    void set_prefilter(uint32_t k, uint32_t min_qual, bool audit);
+
+    /**
+     * Sets the alignment of reads with quantized scores.  If audit is true, the
+     * reads are aligned without too and the differences are recorded.
+     */
+    void set_quantized(bool quantized, bool audit);
+
+    /**
+     * Aligns the reads collected for an indel and adds them to the body of evidence.
+     */
+    void compute(LHMM *lhmm);
+
+    /**
+     * Prints record with GT, PL and DP.
+     */
+    void print(BCFOrderedWriter *odw);
+
+    /**
+     * Clears this record.
+     */
+    void clear();
+
+    private:
+
+    /**
+     * Gets the probes of an indel from the probe cache.
+     * Returns false if the probes are ill defined.
+     */
+    bool get_probes();
+
+    /**
+     * Gets the log10 likelihoods of the genotypes RR, RA and AA of a SNP given a read,
+     * these are looked up by base quality.  Returns NULL if the read carries neither allele.
+     */
+    const double* genotype_snp(GenotypingRead *read);
+
+    /**
+     * Adds the log10 likelihoods of a read given the reference and alternative allele to gls.
+     */
+    void add_llks(int32_t sample_id, double refllk, double altllk);
+
+    /**
+     * Builds the sets of k-mers specific to each probe.
+     */
+    void set_allele_kmers();
+
+    /**
+     * Classifies the reads by their allele specific k-mers into alleles and
+     * sets the log likelihood ratios given to the prefiltered reads.
+     */
+    void classify_reads(LHMM *lhmm);
+
+    /**
+     * Aligns the reads in batch against the probes and sets their log likelihoods in read_llks.
+     */
+    void align_reads(LHMM *lhmm);
+
+    /**
+     * Classifies a read by its allele specific k-mers, a read that has all the
+     * k-mers specific to one allele and none of the other is classified.
+     * Returns 1 for the reference, 2 for the alternative allele and 0 otherwise.
+     */
+    int32_t prefilter(GenotypingRead *read);
+};
 
 #endif
\ No newline at end of file
@@ -171,6 +171,10 @@ class Igor : Program
         bcf_hdr_append(odw->hdr, "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Normalized, Phred-scaled likelihoods for genotypes\">");
         odw->write_hdr();   
         
+        BCFRecordBuilder rb(odw->hdr);
+        int32_t GT_tag = rb.add_format_tag("GT");
+        int32_t PL_tag = rb.add_format_tag("PL");
+        
         
 
 //        if ( v->n_fmt) 
@@ -236,11 +240,9 @@ class Igor : Program
             //update alleles
             bcf1_t *v = current_recs[0]->v;
             bcf_hdr_t *h = current_recs[0]->h;
-            bcf1_t *nv = odw->get_bcf1_from_pool();
-            bcf_set_chrom(odw->hdr, nv, bcf_get_chrom(h, v));
-            bcf_set_pos1(nv, bcf_get_pos1(v));
-            bcf_update_alleles(odw->hdr, nv, const_cast<const char**>(bcf_get_allele(v)), bcf_get_n_allele(v));
-            bcf_set_n_sample(nv, no_samples);
+            rb.set_chrom(bcf_get_chrom(h, v));
+            rb.set_pos1(bcf_get_pos1(v));
+            rb.set_alleles(const_cast<const char**>(bcf_get_allele(v)), bcf_get_n_allele(v));
             
 //            
 //            for (uint32_t i=0; i<current_recs.size(); ++i)
@@ -314,8 +316,10 @@ class Igor : Program
             
             
             //update individual information
-            bcf_update_genotypes(odw->hdr,nv,cgt,ngt*2);
-            bcf_update_format_int32(odw->hdr,nv,"PL",pls,ngt*3);
+            rb.set_format_int32(GT_tag, cgt, ngt*2);
+            rb.set_format_int32(PL_tag, pls, ngt*3);
+            bcf1_t *nv = odw->get_bcf1_from_pool();
+            rb.build(nv);
             odw->write(nv);
         }
         
@@ -33,10 +33,10 @@ class Evidence
     uint32_t* e;
     uint32_t* n;
     kstring_t samples;
+    kstring_t alleles;
     int32_t esum, nsum;
     double af;
     double lr;
-    bcf1_t *v;
 
     Evidence(uint32_t m)
     {
@@ -45,11 +45,11 @@ class Evidence
         e = (uint32_t*) malloc(m*sizeof(uint32_t));
         n = (uint32_t*) malloc(m*sizeof(uint32_t));
         samples = {0,0,0};
+        alleles = {0,0,0};
         esum = 0;
         nsum = 0;
         af = 0;
         lr = 0;
-        v = NULL;
     };
 
     ~Evidence()
@@ -58,18 +58,18 @@ class Evidence
         free(e);
         free(n);
         if (samples.m) free(samples.s);
-        v = NULL;
+        if (alleles.m) free(alleles.s);
     };
 
     void clear()
     {
         i = 0;
         samples.l = 0;
+        alleles.l = 0;
         esum = 0;
         nsum = 0;
         af = 0;
         lr = 0;
-        v = NULL;
     };
 };
 
@@ -95,6 +95,8 @@ class Igor : Program
     BCFSyncedReader *sr;
     BCFOrderedWriter *odw;
     bcf1_t *v;
+    BCFRecordBuilder *rb;
+    int32_t SAMPLES_tag, NSAMPLES_tag, E_tag, N_tag, ESUM_tag, NSUM_tag, AF_tag, LR_tag;
 
     ///////////////
     //general use//
@@ -186,9 +188,19 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
         bcf_hdr_append(odw->hdr, "##INFO=<ID=ESUM,Number=1,Type=Integer,Description=\"Total evidence read count\">");
         bcf_hdr_append(odw->hdr, "##INFO=<ID=NSUM,Number=1,Type=Integer,Description=\"Total read count\">");
         bcf_hdr_append(odw->hdr, "##INFO=<ID=AF,Number=A,Type=Float,Description=\"Allele Frequency\">");
-        bcf_hdr_append(odw->hdr, "##INFO=<ID=LR,Number=1,Type=String,Description=\"Likelihood Ratio Statistic\">");
+        bcf_hdr_append(odw->hdr, "##INFO=<ID=LR,Number=1,Type=Float,Description=\"Likelihood Ratio Statistic\">");
         odw->write_hdr();
 
+        rb = new BCFRecordBuilder(odw->hdr);
+        SAMPLES_tag = rb->add_info_tag("SAMPLES");
+        NSAMPLES_tag = rb->add_info_tag("NSAMPLES");
+        E_tag = rb->add_info_tag("E");
+        N_tag = rb->add_info_tag("N");
+        ESUM_tag = rb->add_info_tag("ESUM");
+        NSUM_tag = rb->add_info_tag("NSUM");
+        AF_tag = rb->add_info_tag("AF");
+        LR_tag = rb->add_info_tag("LR");
+
         ///////////////
         //general use//
         ///////////////
@@ -232,6 +244,10 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
         std::vector<bcfptr*> current_recs;
         while(sr->read_next_position(current_recs))
         {
+            //the records are all at the same position
+            const char* chrom = bcf_get_chrom(current_recs[0]->h, current_recs[0]->v);
+            int32_t pos1 = bcf_get_pos1(current_recs[0]->v);
+
             for (uint32_t i=0; i<current_recs.size(); ++i)
             {
                 int32_t file_index = current_recs[i]->file_index;
@@ -263,11 +279,11 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
                         }
 
                         //update variant information
-                        bcf1_t* nv = odw->get_bcf1_from_pool();
-                        bcf_set_chrom(odw->hdr, nv, bcf_get_chrom(h, v));
-                        bcf_set_pos1(nv, bcf_get_pos1(v));
-                        bcf_update_alleles(odw->hdr, nv, const_cast<const char**>(bcf_get_allele(v)), bcf_get_n_allele(v));
-                        kh_value(m, k)->v = nv;
+                        for (int32_t j=0; j<bcf_get_n_allele(v); ++j)
+                        {
+                            if (j) kputc(',', &kh_value(m, k)->alleles);
+                            kputs(bcf_get_alt(v, j), &kh_value(m, k)->alleles);
+                        }
                     }
 
 
@@ -297,7 +313,6 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
             {
                 if (kh_exist(m, k))
                 {
-                    bcf1_t *nv = kh_value(m, k)->v;
                     int32_t nobs = kh_value(m, k)->i;
                     float af = kh_value(m, k)->af/no_samples;
 
@@ -331,21 +346,24 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
                         denum += lt->log10choose(n[i], e[i]) + (n[i]-e[i])*log10me + e[i]*log10e;
                     }
 
-                    bcf_update_info_string(odw->hdr, nv, "SAMPLES", kh_value(m, k)->samples.s);
-                    bcf_update_info_int32(odw->hdr, nv, "NSAMPLES", &kh_value(m, k)->i, 1);
-                    bcf_update_info_int32(odw->hdr, nv, "E", kh_value(m, k)->e, kh_value(m, k)->i);
-                    bcf_update_info_int32(odw->hdr, nv, "N", kh_value(m, k)->n, kh_value(m, k)->i);
-                    bcf_update_info_int32(odw->hdr, nv, "ESUM", &kh_value(m, k)->esum, 1);
-                    bcf_update_info_int32(odw->hdr, nv, "NSUM", &kh_value(m, k)->nsum, 1);
-
-                    bcf_update_info_float(odw->hdr, nv, "AF", &af, 1);
-
                     float lr = num-denum;
 
-                    bcf_update_info_float(odw->hdr, nv, "LR", &lr, 1);
-
+                    //only the records written out are built
                     if (lr>lr_cutoff)
                     {
+                        rb->set_chrom(chrom);
+                        rb->set_pos1(pos1);
+                        rb->set_alleles(kh_value(m, k)->alleles.s);
+                        rb->set_info_string(SAMPLES_tag, kh_value(m, k)->samples.s);
+                        rb->set_info_int32(NSAMPLES_tag, (int32_t*)&kh_value(m, k)->i, 1);
+                        rb->set_info_int32(E_tag, (int32_t*)kh_value(m, k)->e, kh_value(m, k)->i);
+                        rb->set_info_int32(N_tag, (int32_t*)kh_value(m, k)->n, kh_value(m, k)->i);
+                        rb->set_info_int32(ESUM_tag, &kh_value(m, k)->esum, 1);
+                        rb->set_info_int32(NSUM_tag, &kh_value(m, k)->nsum, 1);
+                        rb->set_info_float(AF_tag, &af, 1);
+                        rb->set_info_float(LR_tag, &lr, 1);
+                        bcf1_t *nv = odw->get_bcf1_from_pool();
+                        rb->build(nv);
                         odw->write(nv);
 
                         int32_t vtype = vm->classify_variant(odw->hdr,nv);
@@ -366,10 +384,6 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
                             ++no_other_variant_types;
                         }
                     }
-                    else
-                    {
-                        odw->store_bcf1_into_pool(nv);
-                    }
                     delete kh_value(m, k);
                     free((char*)kh_key(m, k));
 
@@ -402,6 +416,7 @@ Each VCF file is required to have the FORMAT flags E and N and should have exact
 
     ~Igor()
     {
+        delete rb;
     };
 
     private:
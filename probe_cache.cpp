@@ -0,0 +1,118 @@
+/* The MIT License
+
+   Copyright (c) 2014 Adrian Tan <atks@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "probe_cache.h"
+
+/**
+ * Constructor.
+ */
+ProbeCache::ProbeCache(std::string ref_fasta_file, uint32_t min_flank_length, uint32_t max_size)
+{
+    vm = new VariantManip(ref_fasta_file);
+    if (!vm->reference_present)
+    {
+        fprintf(stderr, "[E:%s:%d %s] reference sequence %s cannot be read\n", __FILE__, __LINE__, __FUNCTION__, ref_fasta_file.c_str());
+        exit(1);
+    }
+
+    this->min_flank_length = min_flank_length;
+    this->max_size = max_size ? max_size : 1;
+    key = {0,0,0};
+
+    no_probes_generated = 0;
+    no_cached_probes = 0;
+};
+
+/**
+ * Destructor.
+ */
+ProbeCache::~ProbeCache()
+{
+    delete vm;
+    if (key.m) free(key.s);
+};
+
+/**
+ * Gets the reference and alternative probes of a biallelic variant.
+ * Returns false if the probes are ill defined.
+ */
+bool ProbeCache::get_probes(const char* chrom, int32_t pos1, const char* ref, const char* alt, std::string& ref_probe, std::string& alt_probe)
+{
+    //normalize as vt normalize does so that all representations share an entry
+    alleles.clear();
+    alleles.push_back(ref);
+    alleles.push_back(alt);
+    uint32_t norm_pos1 = pos1;
+    uint32_t left_aligned = 0;
+    uint32_t left_trimmed = 0;
+    uint32_t right_trimmed = 0;
+    vm->left_align(alleles, norm_pos1, chrom, left_aligned, right_trimmed);
+    vm->left_trim(alleles, norm_pos1, left_trimmed);
+    for (uint32_t j=0; j<alleles.size(); ++j)
+    {
+        std::transform(alleles[j].begin(), alleles[j].end(), alleles[j].begin(), ::toupper);
+    }
+
+    key.l = 0;
+    ksprintf(&key, "%s:%d:%s:%s", chrom, norm_pos1, alleles[0].c_str(), alleles[1].c_str());
+
+    std::map<std::string, std::vector<std::string> >::iterator i = cache.find(std::string(key.s, key.l));
+    if (i!=cache.end())
+    {
+        ++no_cached_probes;
+    }
+    else
+    {
+        if (cache.size()>=max_size)
+        {
+            cache.erase(keys.front());
+            keys.pop_front();
+        }
+
+        i = cache.insert(std::make_pair(std::string(key.s, key.l), std::vector<std::string>())).first;
+        keys.push_back(i->first);
+
+        std::vector<std::string> probes;
+        int32_t preamble_length = 0;
+        vm->generate_probes(chrom, norm_pos1, 1, alleles, probes, min_flank_length, preamble_length);
+
+        //remove ill defined probes
+        if (probes.size()==2 &&
+            probes[0].find('N')==std::string::npos &&
+            probes[1].find('N')==std::string::npos)
+        {
+            i->second.swap(probes);
+        }
+
+        ++no_probes_generated;
+    }
+
+    if (i->second.empty())
+    {
+        return false;
+    }
+
+    ref_probe = i->second[0];
+    alt_probe = i->second[1];
+    return true;
+};
@@ -0,0 +1,85 @@
+/* The MIT License
+
+   Copyright (c) 2014 Adrian Tan <atks@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include <map>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+#include "htslib/kstring.h"
+#include "variant_manip.h"
+
+/**
+ * Generates the probes of biallelic indels from the reference
+ * sequence as construct_probes does and remembers the most recent
+ * ones, so that a variant present in several records, or genotyped
+ * again, is only generated once.
+ *
+ * Variants are normalized first and keyed by chromosome, position
+ * and alleles of the normalized variant, the probes are generated
+ * from the normalized variant so that every representation of an
+ * indel gets the same probes.  For normalized input the probes are
+ * those of construct_probes.  The cache holds at most max_size
+ * variants and forgets the oldest first.
+ */
+class ProbeCache
+{
+    public:
+    uint32_t min_flank_length;
+    uint32_t max_size;
+
+    //stats
+    uint32_t no_probes_generated;
+    uint32_t no_cached_probes;
+
+    /**
+     * Constructor.
+     */
+    ProbeCache(std::string ref_fasta_file, uint32_t min_flank_length=20, uint32_t max_size=1024);
+
+    /**
+     * Destructor.
+     */
+    ~ProbeCache();
+
+    /**
+     * Gets the reference and alternative probes of a biallelic variant.
+     * Returns false if the probes are ill defined.
+     */
+    bool get_probes(const char* chrom, int32_t pos1, const char* ref, const char* alt, std::string& ref_probe, std::string& alt_probe);
+
+    private:
+    VariantManip *vm;
+
+    //probes by variant key, an empty entry marks ill defined probes
+    std::map<std::string, std::vector<std::string> > cache;
+    std::list<std::string> keys;
+
+    kstring_t key;
+    std::vector<std::string> alleles;
+};
+
+#endif
@@ -394,62 +394,106 @@ void VariantManip::left_trim(std::vector<std::string>& alleles, uint32_t& pos1,
 
 /**
  * Left aligns a variant.
- * @todo: rewrite input as char**
+ *
+ * The alleles all get the same bases prepended from the reference and the
+ * same number of bases trimmed from their right ends, so instead of editing
+ * every allele at each step, the prepended bases are kept in reverse with the
+ * count of trimmed bases and the alleles are rebuilt once at the end.  The
+ * reference is fetched in windows to the left of the variant that double in
+ * size, rather than a base at a time.
  */
 void VariantManip::left_align(std::vector<std::string>& alleles, uint32_t& pos1, const char* chrom, uint32_t& left_aligned, uint32_t& right_trimmed)
 {
-    bool may_right_trim =  true;
-    bool may_left_align = false;
-    char lastBase = ' ';
+    std::string prepended; //in reverse
+    uint32_t trimmed = 0;
 
-    for (uint32_t i=0; i<alleles.size(); ++i)
+    //reference window, 0-based
+    char *window = NULL;
+    int32_t window_beg0 = 0;
+    int32_t window_end0 = -1;
+    int32_t window_size = 32;
+
+    while (true)
     {
-        if (!alleles[i].empty())
+        bool may_right_trim = true;
+        bool may_left_align = false;
+        char last_base = ' ';
+
+        for (uint32_t i=0; i<alleles.size(); ++i)
         {
-            lastBase = (lastBase != ' ') ? lastBase : ::tolower(alleles[i].at(alleles[i].size()-1));
-            if (lastBase != ::tolower(alleles[i].at(alleles[i].size()-1)))
+            uint32_t len = prepended.size()+alleles[i].size()-trimmed;
+            if (len)
+            {
+                char base = len>prepended.size() ? alleles[i].at(len-prepended.size()-1) : prepended.at(prepended.size()-len);
+                base = ::tolower(base);
+                last_base = (last_base != ' ') ? last_base : base;
+                if (last_base != base)
+                {
+                    may_right_trim = false;
+                }
+            }
+            else
             {
+                may_left_align = true;
                 may_right_trim = false;
+                break;
             }
         }
-        else
+
+        if (may_left_align)
         {
-            may_left_align = true;
-            may_right_trim = false;
-            break;
-        }
-    }
+            //cannot move past the start of the chromosome
+            if (pos1<=1)
+            {
+                break;
+            }
 
-    if(may_left_align)
-    {
-        std::string base = "";
+            --pos1;
+            int32_t pos0 = pos1-1;
 
-        --pos1;
+            if (pos0<window_beg0 || pos0>window_end0)
+            {
+                if (window) free(window);
 
-        int ref_len = 0;
+                window_end0 = pos0;
+                window_beg0 = pos0-window_size+1>0 ? pos0-window_size+1 : 0;
+                window_size *= 2;
 
-        char *ref = faidx_fetch_seq(fai, chrom, pos1-1, pos1-1, &ref_len);
-        base = std::string(ref);
-        std::transform(base.begin(), base.end(), base.begin(), ::tolower);
-        free(ref);
+                int32_t ref_len = 0;
+                window = faidx_fetch_seq(fai, chrom, window_beg0, window_end0, &ref_len);
+                if (!window || ref_len!=window_end0-window_beg0+1)
+                {
+                    fprintf(stderr, "[E:%s:%d %s] cannot read reference sequence %s:%d-%d\n", __FILE__, __LINE__, __FUNCTION__, chrom, window_beg0+1, window_end0+1);
+                    exit(1);
+                }
+            }
 
-        for (uint32_t i=0; i<alleles.size(); ++i)
+            prepended.push_back(::tolower(window[pos0-window_beg0]));
+            ++left_aligned;
+        }
+        else if (may_right_trim)
         {
-            alleles[i].insert(0, 1, base.at(0));
+            ++trimmed;
+            ++right_trimmed;
+        }
+        else
+        {
+            break;
         }
-
-        ++left_aligned;
-        return left_align(alleles, pos1, chrom, left_aligned, right_trimmed);
     }
-    else if (may_right_trim)
+
+    if (window) free(window);
+
+    if (prepended.size() || trimmed)
     {
+        std::string allele;
         for (uint32_t i=0; i<alleles.size(); ++i)
         {
-            alleles[i].erase(alleles[i].size()-1);
+            allele.assign(prepended.rbegin(), prepended.rend());
+            allele.append(alleles[i], 0, alleles[i].size()>trimmed ? alleles[i].size()-trimmed : 0);
+            allele.resize(prepended.size()+alleles[i].size()-trimmed);
+            alleles[i].swap(allele);
         }
-
-        ++right_trimmed;
-        return left_align(alleles, pos1, chrom, left_aligned, right_trimmed);
     }
 };
 
@@ -485,12 +529,13 @@ void VariantManip::generate_probes(const char* chrom,
         char *base;
         uint32_t i = 1;
         int32_t ref_len;
-        while (bases.size()<4 || preamble.size()<min_flank_length)
+        while ((bases.size()<4 || preamble.size()<min_flank_length) && pos1-1-(int32_t)i>=0)
         {
-            base = faidx_fetch_seq(fai, const_cast<char*>(chrom), pos1-1, pos1-1, &ref_len);
+            base = faidx_fetch_seq(fai, const_cast<char*>(chrom), pos1-1-i, pos1-1-i, &ref_len);
+            if (ref_len<=0) break;
             preamble.append(1,base[0]);
             bases[base[0]] = 1;
-            if (ref_len>0) free(base);
+            free(base);
             ++i;
         }
 
@@ -499,10 +544,11 @@ void VariantManip::generate_probes(const char* chrom,
         uint32_t alleleLength = alleles[0].size();
         while (bases.size()<4 || postamble.size()<min_flank_length)
         {
-            base = faidx_fetch_seq(fai, const_cast<char*>(chrom), pos1+alleleLength+i, pos1+alleleLength+i, &ref_len);
+            base = faidx_fetch_seq(fai, const_cast<char*>(chrom), pos1-1+alleleLength+i, pos1-1+alleleLength+i, &ref_len);
+            if (ref_len<=0) break;
             postamble.append(1,base[0]);
             bases[base[0]] = 1;
-            if (ref_len>0) free(base);
+            free(base);
             ++i;
         }
 
@@ -544,17 +590,19 @@ void VariantManip::generate_probes(const char* chrom,
         char* base;
         uint32_t i = 1;
         int32_t ref_len = 0;
-        while (bases.size()<4 && preamble.size()<min_flank_length)
+        while ((bases.size()<4 || preamble.size()<min_flank_length) && pos1-1-(int32_t)i>=0)
         {
-            base = faidx_fetch_seq(fai, const_cast<char*>(chrom), pos1+i-1, pos1+i-1, &ref_len);
+            base = faidx_fetch_seq(fai, const_cast<char*>(chrom), pos1-1-i, pos1-1-i, &ref_len);
+            if (ref_len<=0) break;
             preamble.append(1,base[0]);
             bases[base[0]] = 1;
             ++i;
             if (base[0]=='N')
             {
+                free(base);
                 break;
             }
-            if (ref_len>0) free(base);
+            free(base);
         }
 
         preambleLength = preamble.size();
@@ -596,7 +644,7 @@ void VariantManip::generate_probes(const char* chrom,
                     int32_t start1 = (pos1+length-alleles[i].size()+alleles[0].size()-1);
                     int32_t ref_len;
                     char* base = faidx_fetch_seq(fai, const_cast<char*>(chrom), start1 , start1, &ref_len);
-                    probes[i].append(1, base[0]);
+                    probes[i].append(1, ref_len>0 ? base[0] : 'N');
                     if (ref_len>0) free(base);
                 }
             }